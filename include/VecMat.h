@@ -4,149 +4,272 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <stdexcept>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include "blocked_gemm.h"
+#include "parallel.h"
 
 
 class Matrix;
 
 
+// copy-on-write instrumentation: how often a shared buffer had to be
+// copied before a write, and how many bytes those copies moved
+struct CowStats {
+    static inline std::atomic<size_t> vector_detaches{0};
+    static inline std::atomic<size_t> matrix_detaches{0};
+    static inline std::atomic<size_t> bytes_copied{0};
+
+    static void reset() {
+        vector_detaches = 0;
+        matrix_detaches = 0;
+        bytes_copied = 0;
+    }
+};
+
+
+// what a non-const operator[] returns instead of double&. Reading goes
+// straight to the buffer even if it is shared, only a write makes the
+// owner detach first, and it does so on every write, so a proxy kept
+// across a copy of its owner can't change that copy
+template <typename Owner, typename Index>
+class ElementRef {
+private:
+    Owner* owner;
+    Index idx;
+
+public:
+    ElementRef(Owner* element_owner, Index element_idx) : owner(element_owner), idx(element_idx) {}
+
+    ElementRef(const ElementRef&) = default;
+
+    operator double() const {
+        return owner->read_element(idx);
+    }
+
+    ElementRef& operator= (double value) {
+        owner->write_element(idx) = value;
+        return *this;
+    }
+
+    ElementRef& operator= (const ElementRef& another_ref) {
+        return *this = static_cast<double>(another_ref);
+    }
+
+    ElementRef& operator+= (double value) {
+        owner->write_element(idx) += value;
+        return *this;
+    }
+
+    ElementRef& operator-= (double value) {
+        owner->write_element(idx) -= value;
+        return *this;
+    }
+
+    ElementRef& operator*= (double value) {
+        owner->write_element(idx) *= value;
+        return *this;
+    }
+
+    ElementRef& operator/= (double value) {
+        owner->write_element(idx) /= value;
+        return *this;
+    }
+};
+
+
 class Vector {
 private:
-    std::vector<double> vec;
+    // shared between copies until one of them writes, see detach()
+    std::shared_ptr<std::vector<double>> vec;
+
+    friend class ElementRef<Vector, size_t>;
+
+    // what a moved-from vector is left holding
+    static const std::shared_ptr<std::vector<double>>& empty_buffer() {
+        static const auto empty = std::make_shared<std::vector<double>>();
+        return empty;
+    }
+
+    // give this vector its own buffer before a write if it is shared
+    void detach() {
+        if (vec.use_count() > 1) {
+            vec = std::make_shared<std::vector<double>>(*vec);
+            CowStats::vector_detaches++;
+            CowStats::bytes_copied += vec->size() * sizeof(double);
+        }
+        else {
+            // pairs with the release of the last other owner, so its
+            // reads of the buffer finish before we write to it
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+    }
+
+    double read_element(size_t idx) const {
+        return (*vec)[idx];
+    }
+
+    double& write_element(size_t idx) {
+        detach();
+        return (*vec)[idx];
+    }
 
 public:
 
     // initialize with fixed value
     Vector(const size_t& size, const double& init_value=0){
-        vec.assign(size, init_value);
+        vec = std::make_shared<std::vector<double>>(size, init_value);
     }
 
     // initialize with a double arr
     Vector(const double* init_arr) {
         int size = sizeof(init_arr);
+        vec = std::make_shared<std::vector<double>>(size);
         for (int i=0 ; i < size; i++){
-            vec[i] = init_arr[i];
+            (*vec)[i] = init_arr[i];
         }
     }
 
-    // initialize with another vector instance
-    Vector(const Vector& another_vector){
-        for (size_t i=0 ; i < another_vector.size(); i++){
-            vec.push_back(another_vector[i]);
-        }
+    // copies share the buffer, O(1)
+    Vector(const Vector& another_vector) = default;
+
+    // the moved-from vector is left empty
+    Vector(Vector&& another_vector) noexcept : vec(std::move(another_vector.vec)) {
+        another_vector.vec = empty_buffer();
     }
 
     size_t size() const {
-        return vec.size();
+        return vec->size();
     }
 
     size_t size() {
-        return vec.size();
+        return vec->size();
+    }
+
+    // true if the buffer is currently shared with another copy
+    bool is_shared() const {
+        return vec.use_count() > 1;
     }
 
     double dot(const Vector& other_vector) const {
-        if (vec.size() != other_vector.size()){
+        if (vec->size() != other_vector.size()){
             throw std::invalid_argument("Dot product dimension doesn't match.");
         }
         double rst = 0;
-        for (size_t i=0; i<vec.size(); i++){
-            rst += vec[i] * other_vector[i];
+        for (size_t i=0; i<vec->size(); i++){
+            rst += (*vec)[i] * other_vector[i];
         }
         return rst;
     }
 
-    Vector dot(const Matrix& mat);
+    // vec^T * mat, defined in level2.h
+    Vector dot(const Matrix& mat) const;
 
     double norm() const{
         return sqrt(this->dot(*this));
     }
 
-    Vector& operator= (const Vector& another_vec) {
-        if (this == &another_vec){
-            return *this;
-        }
-        vec.clear();
-        for (auto num : another_vec) {
-            vec.push_back(num);
+    Vector& operator= (const Vector& another_vec) = default;
+
+    Vector& operator= (Vector&& another_vec) noexcept {
+        if (this != &another_vec) {
+            vec = std::move(another_vec.vec);
+            another_vec.vec = empty_buffer();
         }
         return *this;
     }
 
-    auto operator[] (size_t idx) -> double& {
+    // reads through the proxy never copy, writes detach, see ElementRef
+    auto operator[] (size_t idx) -> ElementRef<Vector, size_t> {
         if (idx >= size()) {
             throw std::out_of_range("Index out of range.");
         }
-        return vec[idx];
+        return ElementRef<Vector, size_t>(this, idx);
     }
 
     auto operator[] (size_t idx) const -> const double& {
         if (idx >= size()) {
             throw std::out_of_range("Index out of range.");
         }
-        return vec[idx];
+        return (*vec)[idx];
     }
 
-    auto begin() -> std::vector<double>::iterator {
-        return vec.begin();
+    // iteration is read-only, so it never copies, write through
+    // operator[] or data()
+    auto begin() const -> std::vector<double>::const_iterator {
+        return vec->cbegin();
     }
 
-    auto begin() const -> std::vector<double>::const_iterator {
-        return vec.begin();
+    auto end() const -> std::vector<double>::const_iterator {
+        return vec->cend();
     }
 
-    auto end() -> std::vector<double>::iterator {
-        return vec.end();
+    // raw access for kernels and bulk writes, detaches once. A copy made
+    // later shares the buffer again, so the pointer may only be written
+    // through until this vector is next copied
+    double* data() {
+        detach();
+        return vec->data();
     }
 
-    auto end() const -> std::vector<double>::const_iterator {
-        return vec.end();
+    const double* data() const {
+        return vec->data();
     }
 
     // overload operator +
     Vector operator + (const Vector& another_vector) const {
-        if (vec.size() != another_vector.size()) {
+        if (vec->size() != another_vector.size()) {
             throw std::invalid_argument("Array sizes must match. ");
         }
         Vector rst(*this);
-        for (size_t i=0; i<vec.size(); i++) {
-            rst[i] += another_vector[i];
+        double* out = rst.data();
+        const double* other = another_vector.data();
+        for (size_t i=0; i<vec->size(); i++) {
+            out[i] += other[i];
         }
         return rst;
     }
 
     template <typename Scalar>
     Vector operator + (const Scalar& value) const {
-        if (vec.size() == 0) {
+        if (vec->size() == 0) {
             throw std::invalid_argument("Can't add scalar to empty vector.");
         }
         double double_scalar = static_cast<double>(value);
-        Vector rst(vec);
-        for (int i=0; i<vec.size(); i++){
-            rst[i] += double_scalar;
+        Vector rst(*this);
+        double* out = rst.data();
+        for (size_t i=0; i<vec->size(); i++){
+            out[i] += double_scalar;
         }
         return rst;
     }
 
     // overload operator -
     Vector operator - (const Vector& another_vector) const {
-        if (vec.size() != another_vector.size()) {
+        if (vec->size() != another_vector.size()) {
             throw std::invalid_argument("Array sizes must match. ");
         }
         Vector rst(*this);
-        for (size_t i=0; i<vec.size(); i++) {
-            rst[i] -= another_vector[i];
+        double* out = rst.data();
+        const double* other = another_vector.data();
+        for (size_t i=0; i<vec->size(); i++) {
+            out[i] -= other[i];
         }
         return rst;
     }
 
     template <typename Scalar>
     Vector operator - (const Scalar& value) const {
-        if (vec.size() == 0) {
+        if (vec->size() == 0) {
             throw std::invalid_argument("Can't subtract scalar to empty vector.");
         }
         double double_scalar = static_cast<double>(value);
-        Vector rst(vec);
-        for (size_t i=0; i<vec.size(); i++){
-            rst[i] -= double_scalar;
+        Vector rst(*this);
+        double* out = rst.data();
+        for (size_t i=0; i<vec->size(); i++){
+            out[i] -= double_scalar;
         }
         return rst;
     }
@@ -156,7 +279,7 @@ public:
             return false;
         }
         for (size_t i = 0; i < size(); i++) {
-            if (vec[i] != another_vec[i]) {
+            if ((*vec)[i] != another_vec[i]) {
                 return false;
             }
         }
@@ -165,8 +288,8 @@ public:
 
     void display() const {
         printf("[");
-        for (size_t i = 0; i < vec.size(); i++) {
-            printf("%.2lf ", vec[i]);
+        for (size_t i = 0; i < vec->size(); i++) {
+            printf("%.2lf ", (*vec)[i]);
         }
         printf("]\n");
     }
@@ -176,8 +299,41 @@ public:
 
 class Matrix {
 private:
-    std::vector<Vector> mat;
+    // the row list is shared between copies until one of them writes,
+    // rows themselves are shared the same way, so a detach here only
+    // copies row handles and each row copies its data on its first write
+    std::shared_ptr<std::vector<Vector>> mat;
     size_t n_rows, n_cols;
+
+    using Index = std::pair<size_t, size_t>;
+    friend class ElementRef<Matrix, Index>;
+
+    static const std::shared_ptr<std::vector<Vector>>& empty_rows() {
+        static const auto empty = std::make_shared<std::vector<Vector>>();
+        return empty;
+    }
+
+    void detach() {
+        if (mat.use_count() > 1) {
+            mat = std::make_shared<std::vector<Vector>>(*mat);
+            CowStats::matrix_detaches++;
+            CowStats::bytes_copied += mat->size() * sizeof(Vector);
+        }
+        else {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+    }
+
+    double read_element(Index idx) const {
+        const std::vector<Vector>& rows = *mat;
+        return rows[idx.first].data()[idx.second];
+    }
+
+    // detaches the row list, then only the row being written
+    double& write_element(Index idx) {
+        return row_data(idx.first)[idx.second];
+    }
+
     void check_dimension(const Matrix& another_mat) const{
         if (n_rows != another_mat.n_rows) {
             throw std::invalid_argument("Number of Rows doesn't match.");
@@ -188,7 +344,58 @@ private:
     }
 
 public: 
-    Matrix() : n_rows(0), n_cols(0) {};
+    // what non-const operator[] returns: reading the row or its elements
+    // goes to the shared storage, writing through it detaches the row
+    // list and then only this row
+    class RowRef {
+    private:
+        Matrix* owner;
+        size_t row;
+
+        const Vector& get() const {
+            return std::as_const(*owner)[row];
+        }
+
+    public:
+        RowRef(Matrix* row_owner, size_t row_idx) : owner(row_owner), row(row_idx) {}
+
+        RowRef(const RowRef&) = default;
+
+        operator const Vector& () const {
+            return get();
+        }
+
+        auto operator[] (size_t col) const -> ElementRef<Matrix, Index> {
+            if (col >= get().size()) {
+                throw std::out_of_range("Index out of range.");
+            }
+            return ElementRef<Matrix, Index>(owner, Index(row, col));
+        }
+
+        // the copy is taken first, vec may be a row of the same matrix
+        RowRef& operator= (const Vector& vec) {
+            Vector copy(vec);
+            owner->detach();
+            (*owner->mat)[row] = std::move(copy);
+            return *this;
+        }
+
+        RowRef& operator= (const RowRef& another_row) {
+            return *this = static_cast<const Vector&>(another_row);
+        }
+
+        size_t size() const { return get().size(); }
+        auto begin() const -> std::vector<double>::const_iterator { return get().begin(); }
+        auto end() const -> std::vector<double>::const_iterator { return get().end(); }
+        // see Matrix::row_data
+        double* data() const { return owner->row_data(row); }
+        double dot(const Vector& vec) const { return get().dot(vec); }
+        Vector dot(const Matrix& another_mat) const { return get().dot(another_mat); }
+        double norm() const { return get().norm(); }
+        void display() const { get().display(); }
+    };
+
+    Matrix() : mat(std::make_shared<std::vector<Vector>>()), n_rows(0), n_cols(0) {};
 
     Matrix(const size_t nrows, const size_t ncols, const double init_value = 0) {
         if (nrows == 1 or ncols == 1){
@@ -196,31 +403,32 @@ public:
         }
         n_rows = nrows;
         n_cols = ncols;
+        mat = std::make_shared<std::vector<Vector>>();
+        mat->reserve(n_rows);
         for (size_t i = 0; i < n_rows; i++) {
-            Vector new_row(n_cols, init_value);
-            mat.push_back(new_row);
+            mat->push_back(Vector(n_cols, init_value));
         }
     }
 
-    Matrix(const Matrix& another_mat) {
-        n_rows = another_mat.num_rows();
-        n_cols = another_mat.num_cols();
-        for (auto row_vec : another_mat.mat) {
-            Vector new_row_vec(row_vec);    // ensures deep copy
-            mat.push_back(new_row_vec);
-        }
+    // copies share the rows, O(1)
+    Matrix(const Matrix& another_mat) = default;
+
+    // the moved-from matrix is left 0 x 0
+    Matrix(Matrix&& another_mat) noexcept
+        : mat(std::move(another_mat.mat)), n_rows(another_mat.n_rows), n_cols(another_mat.n_cols) {
+        another_mat.mat = empty_rows();
+        another_mat.n_rows = another_mat.n_cols = 0;
     }
 
-    Matrix& operator=(const Matrix& another_mat) {
-        if (this == &another_mat) {
-            return *this; // handle self-assignment
-        }
-        n_rows = another_mat.num_rows();
-        n_cols = another_mat.num_cols();
-        mat.clear();
-        for (auto row : another_mat) {
-            Vector new_row(row);
-            mat.push_back(new_row);
+    Matrix& operator=(const Matrix& another_mat) = default;
+
+    Matrix& operator=(Matrix&& another_mat) noexcept {
+        if (this != &another_mat) {
+            mat = std::move(another_mat.mat);
+            n_rows = another_mat.n_rows;
+            n_cols = another_mat.n_cols;
+            another_mat.mat = empty_rows();
+            another_mat.n_rows = another_mat.n_cols = 0;
         }
         return *this;
     }
@@ -235,51 +443,105 @@ public:
 
     Matrix transpose() const {
         Matrix rst(n_cols, n_rows);
+        const std::vector<Vector>& rows = *mat;
         for (size_t i = 0; i < n_cols; i++) {
+            double* out = rst.row_data(i);
             for (size_t j = 0; j < n_rows; j++) {
-                rst[i][j] = mat[j][i];
+                out[j] = rows[j][i];
             }
         }
         return rst;
     }
 
-    auto begin() -> std::vector<Vector>::iterator {
-        return mat.begin();
+    // conventional matrix product with the blocked kernel, row blocks
+    // are split across threads
+    Matrix dot(const Matrix& another_mat) const {
+        if (n_cols != another_mat.n_rows) {
+            throw std::invalid_argument("mat_1's n_cols does not match mat_2's n_rows.");
+        }
+        size_t out_cols = another_mat.n_cols;
+        Matrix rst(n_rows, out_cols);
+        if (n_cols == 0 || out_cols == 0) {
+            return rst;
+        }
+        const std::vector<Vector>& a = *mat;
+        const std::vector<Vector>& b = *another_mat.mat;
+        std::vector<const double*> a_rows(n_rows), b_rows(n_cols);
+        std::vector<double*> c_rows(n_rows);
+        for (size_t i = 0; i < n_rows; i++) {
+            a_rows[i] = a[i].data();
+            c_rows[i] = rst.row_data(i);
+        }
+        for (size_t k = 0; k < n_cols; k++) {
+            b_rows[k] = b[k].data();
+        }
+        parallel_for(0, n_rows, [&](size_t row_lo, size_t row_hi) {
+            blocked_gemm(row_hi - row_lo, n_cols, out_cols,
+                         [&](size_t i) { return a_rows[row_lo + i]; },
+                         [&](size_t k) { return b_rows[k]; },
+                         [&](size_t i) { return c_rows[row_lo + i]; });
+        }, 64);
+        return rst;
     }
 
-    auto end() -> std::vector<Vector>::iterator {
-        return mat.end();
+    // mat * vec, defined in level2.h
+    Vector dot(const Vector& vec) const;
+
+    // true if the rows are currently shared with another copy
+    bool is_shared() const {
+        return mat.use_count() > 1;
     }
 
+    // iteration over the rows is read-only, so it never copies, write
+    // through operator[] or row_data()
     auto begin() const -> std::vector<Vector>::const_iterator {
-        return mat.begin();
+        return mat->cbegin();
     }
 
     auto end() const -> std::vector<Vector>::const_iterator {
-        return mat.end();
+        return mat->cend();
     }
 
 
-    auto operator[] (size_t row) -> Vector& {
+    auto operator[] (size_t row) -> RowRef {
         if (row >= n_rows){
             throw std::invalid_argument("Range out of bound.");
         }
-        return mat[row];
+        return RowRef(this, row);
     }
 
     auto operator[] (size_t row) const -> const Vector& {
         if (row >= n_rows){
             throw std::invalid_argument("Range out of bound.");
         }
-        return mat[row];
+        return (*mat)[row];
+    }
+
+    // raw row access for kernels, see Vector::data()
+    double* row_data(size_t row) {
+        if (row >= n_rows){
+            throw std::invalid_argument("Range out of bound.");
+        }
+        detach();
+        return (*mat)[row].data();
+    }
+
+    const double* row_data(size_t row) const {
+        if (row >= n_rows){
+            throw std::invalid_argument("Range out of bound.");
+        }
+        const std::vector<Vector>& rows = *mat;
+        return rows[row].data();
     }
 
     Matrix operator+ (const Matrix& another_mat) const {
         check_dimension(another_mat);
         Matrix rst(*this);
         for (size_t i=0; i<n_rows; i++){
+            double* out = rst.row_data(i);
+            const double* other = another_mat.row_data(i);
             for (size_t j=0; j<n_cols; j++){
-                rst[i][j] += another_mat[i][j];
+                out[j] += other[j];
             }
         }
         return rst;
@@ -289,8 +551,10 @@ public:
         check_dimension(another_mat);
         Matrix rst(*this);
         for (size_t i=0; i<n_rows; i++){
+            double* out = rst.row_data(i);
+            const double* other = another_mat.row_data(i);
             for (size_t j=0; j<n_cols; j++){
-                rst[i][j] -= another_mat[i][j];
+                out[j] -= other[j];
             }
         }
         return rst;
@@ -299,9 +563,12 @@ public:
     Matrix operator* (const Matrix& another_mat) const {
         check_dimension(another_mat);
         Matrix rst(*this);
+        const std::vector<Vector>& rows = *mat;
         for (size_t i=0; i<n_rows; i++){
+            double* out = rst.row_data(i);
+            const double* other = another_mat.row_data(i);
             for (size_t j=0; j<n_cols; j++){
-                rst[i][j] +=  another_mat[i][j] * mat[i][j];
+                out[j] +=  other[j] * rows[i][j];
             }
         }
         return rst;
@@ -311,8 +578,10 @@ public:
         check_dimension(another_mat);
         Matrix rst(*this);
         for (size_t i=0; i<n_rows; i++){
+            double* out = rst.row_data(i);
+            const double* other = another_mat.row_data(i);
             for (size_t j=0; j<n_cols; j++){
-                rst[i][j] /= another_mat[i][j];
+                out[j] /= other[j];
             }
         }
         return rst;
@@ -324,8 +593,9 @@ public:
         double double_value = static_cast<double>(value);
         Matrix rst(*this);
         for (size_t i=0; i<n_rows; i++){
+            double* out = rst.row_data(i);
             for (size_t j=0; j<n_cols; j++){
-                rst[i][j] -= double_value;
+                out[j] -= double_value;
             }
         }
         return rst;
@@ -336,8 +606,9 @@ public:
         double double_value = static_cast<double>(value);
         Matrix rst(*this);
         for (size_t i=0; i<n_rows; i++){
+            double* out = rst.row_data(i);
             for (size_t j=0; j<n_cols; j++){
-                rst[i][j] += double_value;
+                out[j] += double_value;
             }
         }
         return rst;
@@ -348,8 +619,9 @@ public:
         double double_value = static_cast<double>(value);
         Matrix rst(*this);
         for (size_t i=0; i<n_rows; i++){
+            double* out = rst.row_data(i);
             for (size_t j=0; j<n_cols; j++){
-                rst[i][j] *= double_value;
+                out[j] *= double_value;
             }
         }
         return rst;
@@ -360,16 +632,18 @@ public:
         double double_value = static_cast<double>(value);
         Matrix rst(*this);
         for (size_t i=0; i<n_rows; i++){
+            double* out = rst.row_data(i);
             for (size_t j=0; j<n_cols; j++){
-                rst[i][j] /= double_value;
+                out[j] /= double_value;
             }
         }
         return rst;
     }
 
     void display() const {
+        const std::vector<Vector>& rows = *mat;
         for (size_t i = 0; i < n_rows; i++) {
-            mat[i].display();
+            rows[i].display();
         }
         printf("\n");
     }
@@ -612,4 +886,6 @@ public:
 //     return rst;
 // };
 
+#include "level2.h"
+
 #endif
\ No newline at end of file
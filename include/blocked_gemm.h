@@ -0,0 +1,33 @@
+#ifndef BLOCKED_GEMM_H
+#define BLOCKED_GEMM_H
+
+#include <algorithm>
+#include <cstddef>
+
+// c += a * b with the classical loop, blocked so the working tiles of
+// both operands stay in cache. a is m x k and b is k x n; rows are
+// fetched through a_row(i), b_row(p) and c_row(i), so the same kernel
+// serves contiguous buffers and the separately stored rows of a Matrix.
+template <typename ARow, typename BRow, typename CRow>
+void blocked_gemm(size_t m, size_t k, size_t n, ARow a_row, BRow b_row, CRow c_row) {
+    const size_t block = 64;
+    for (size_t kk = 0; kk < k; kk += block) {
+        size_t k_end = std::min(kk + block, k);
+        for (size_t jj = 0; jj < n; jj += block) {
+            size_t j_end = std::min(jj + block, n);
+            for (size_t i = 0; i < m; i++) {
+                const double* a = a_row(i);
+                double* c = c_row(i);
+                for (size_t p = kk; p < k_end; p++) {
+                    double a_ip = a[p];
+                    const double* b = b_row(p);
+                    for (size_t j = jj; j < j_end; j++) {
+                        c[j] += a_ip * b[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,542 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "VecMat.h"
+
+// point to point transport between ranks. The collectives default to
+// binomial trees over send/recv, so a new backend only has to move bytes,
+// and are virtual so a backend with native ones (MPI_Bcast, MPI_Allreduce)
+// can override them. An override of one allreduce_sum overload hides the
+// other unless the backend adds "using Communicator::allreduce_sum;".
+class Communicator {
+public:
+    virtual ~Communicator() = default;
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+    // blocking, messages between a pair of ranks arrive in order
+    virtual void send(int dest, const void* data, size_t bytes) = 0;
+    virtual void recv(int src, void* data, size_t bytes) = 0;
+
+    // root's buffer is copied to every rank of group, group contains root.
+    // Binomial tree: in round r the 2^r ranks that already hold the data
+    // each forward it to one more, so the root sends log2(group) times.
+    virtual void broadcast(double* data, size_t count, int root, const std::vector<int>& group) {
+        size_t n = group.size();
+        size_t root_pos = position_in(group, root);
+        size_t rel = (position_in(group, rank()) + n - root_pos) % n;
+        for (size_t mask = 1; mask < n; mask <<= 1) {
+            if (rel < mask) {
+                if (rel + mask < n) {
+                    send(group[(root_pos + rel + mask) % n], data, count * sizeof(double));
+                }
+            }
+            else if (rel < 2 * mask) {
+                recv(group[(root_pos + rel - mask) % n], data, count * sizeof(double));
+            }
+        }
+    }
+
+    // element-wise sum over the ranks of group, every member ends with the
+    // result. Summed up a binomial tree to group[0], then broadcast back.
+    virtual void allreduce_sum(double* data, size_t count, const std::vector<int>& group) {
+        size_t n = group.size();
+        size_t rel = position_in(group, rank());
+        std::vector<double> incoming;
+        for (size_t mask = 1; mask < n; mask <<= 1) {
+            if (rel & mask) {
+                send(group[rel - mask], data, count * sizeof(double));
+                break;
+            }
+            if (rel + mask < n) {
+                incoming.resize(count);
+                recv(group[rel + mask], incoming.data(), count * sizeof(double));
+                for (size_t i = 0; i < count; i++) {
+                    data[i] += incoming[i];
+                }
+            }
+        }
+        broadcast(data, count, group[0], group);
+    }
+
+    // element-wise sum over all ranks
+    virtual void allreduce_sum(double* data, size_t count) {
+        std::vector<int> everyone(size());
+        for (int r = 0; r < size(); r++) {
+            everyone[r] = r;
+        }
+        allreduce_sum(data, count, everyone);
+    }
+
+private:
+    static size_t position_in(const std::vector<int>& group, int r) {
+        for (size_t i = 0; i < group.size(); i++) {
+            if (group[i] == r) {
+                return i;
+            }
+        }
+        throw std::invalid_argument("Rank is not a member of the group.");
+    }
+};
+
+
+// ranks are local processes joined pairwise by Unix domain sockets
+class LocalSocketCommunicator : public Communicator {
+private:
+    int my_rank;
+    std::vector<int> peer_fds;     // peer_fds[r] is the socket to rank r, -1 for self
+
+public:
+    LocalSocketCommunicator(int rank, std::vector<int> fds) : my_rank(rank), peer_fds(std::move(fds)) {}
+
+    LocalSocketCommunicator(const LocalSocketCommunicator&) = delete;
+    LocalSocketCommunicator& operator=(const LocalSocketCommunicator&) = delete;
+
+    ~LocalSocketCommunicator() {
+        for (int fd : peer_fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    int rank() const override {
+        return my_rank;
+    }
+
+    int size() const override {
+        return static_cast<int>(peer_fds.size());
+    }
+
+    // MSG_NOSIGNAL turns a dead peer into an error instead of SIGPIPE
+    void send(int dest, const void* data, size_t bytes) override {
+        const char* ptr = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t n = ::send(peer_fds.at(dest), ptr, bytes, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw std::runtime_error("Send to rank " + std::to_string(dest) + " failed.");
+            }
+            ptr += n;
+            bytes -= static_cast<size_t>(n);
+        }
+    }
+
+    void recv(int src, void* data, size_t bytes) override {
+        char* ptr = static_cast<char*>(data);
+        while (bytes > 0) {
+            ssize_t n = ::recv(peer_fds.at(src), ptr, bytes, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw std::runtime_error("Receive from rank " + std::to_string(src) + " failed.");
+            }
+            ptr += n;
+            bytes -= static_cast<size_t>(n);
+        }
+    }
+};
+
+// run body on nprocs ranks, rank 0 is the calling process and the others
+// are forked children. Returns the number of ranks whose body threw.
+inline int launch_local_ranks(int nprocs, const std::function<void(Communicator&)>& body) {
+    if (nprocs < 1) {
+        throw std::invalid_argument("Number of ranks must be >= 1.");
+    }
+    // fds[i][j] is the end of the i-j socket pair owned by rank i
+    std::vector<std::vector<int>> fds(nprocs, std::vector<int>(nprocs, -1));
+    auto close_all_but = [&](int keep) {
+        for (int i = 0; i < nprocs; i++) {
+            if (i == keep) {
+                continue;
+            }
+            for (int& fd : fds[i]) {
+                if (fd >= 0) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+        }
+    };
+    for (int i = 0; i < nprocs; i++) {
+        for (int j = i + 1; j < nprocs; j++) {
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+                close_all_but(-1);
+                throw std::runtime_error("socketpair failed.");
+            }
+            fds[i][j] = sv[0];
+            fds[j][i] = sv[1];
+        }
+    }
+
+    fflush(nullptr);
+    std::vector<pid_t> children;
+    for (int r = 1; r < nprocs; r++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            close_all_but(-1);
+            for (pid_t child : children) {
+                kill(child, SIGKILL);
+                waitpid(child, nullptr, 0);
+            }
+            throw std::runtime_error("fork failed.");
+        }
+        if (pid == 0) {
+            // the child never returns into the caller's code
+            int status = 1;
+            try {
+                close_all_but(r);
+                LocalSocketCommunicator comm(r, fds[r]);
+                body(comm);
+                status = 0;
+            }
+            catch (const std::exception& e) {
+                fprintf(stderr, "rank %d: %s\n", r, e.what());
+            }
+            catch (...) {
+                fprintf(stderr, "rank %d: unknown exception\n", r);
+            }
+            fflush(nullptr);
+            _exit(status);
+        }
+        children.push_back(pid);
+    }
+    close_all_but(0);
+
+    int failed = 0;
+    try {
+        LocalSocketCommunicator comm(0, fds[0]);
+        body(comm);
+    }
+    catch (const std::exception& e) {
+        fprintf(stderr, "rank 0: %s\n", e.what());
+        failed++;
+    }
+    catch (...) {
+        fprintf(stderr, "rank 0: unknown exception\n");
+        failed++;
+    }
+    for (pid_t pid : children) {
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+
+// ranks arranged as a grid_rows x grid_cols grid, rank = row * grid_cols + col
+class ProcessGrid {
+private:
+    int grid_rows, grid_cols, my_row, my_col;
+
+public:
+    // picks the most square grid for the communicator's size
+    ProcessGrid(const Communicator& comm) {
+        int nprocs = comm.size();
+        grid_rows = static_cast<int>(std::sqrt(static_cast<double>(nprocs)));
+        while (nprocs % grid_rows != 0) {
+            grid_rows--;
+        }
+        grid_cols = nprocs / grid_rows;
+        my_row = comm.rank() / grid_cols;
+        my_col = comm.rank() % grid_cols;
+    }
+
+    ProcessGrid(const Communicator& comm, int nrows, int ncols) : grid_rows(nrows), grid_cols(ncols) {
+        if (nrows < 1 || ncols < 1 || nrows * ncols != comm.size()) {
+            throw std::invalid_argument("Process grid doesn't match the number of ranks.");
+        }
+        my_row = comm.rank() / grid_cols;
+        my_col = comm.rank() % grid_cols;
+    }
+
+    int num_rows() const { return grid_rows; }
+    int num_cols() const { return grid_cols; }
+    int row() const { return my_row; }
+    int col() const { return my_col; }
+
+    int rank_of(int row, int col) const {
+        return row * grid_cols + col;
+    }
+
+    // ranks sharing this rank's grid row
+    std::vector<int> row_group() const {
+        std::vector<int> group;
+        for (int c = 0; c < grid_cols; c++) {
+            group.push_back(rank_of(my_row, c));
+        }
+        return group;
+    }
+
+    // ranks sharing this rank's grid column
+    std::vector<int> col_group() const {
+        std::vector<int> group;
+        for (int r = 0; r < grid_rows; r++) {
+            group.push_back(rank_of(r, my_col));
+        }
+        return group;
+    }
+};
+
+
+// matrix split over a process grid with a 2D block-cyclic layout: global
+// block (bi, bj) of size block x block lives on grid position
+// (bi % grid rows, bj % grid cols). Each rank stores its blocks as one
+// row-major local array.
+class DistributedMatrix {
+private:
+    Communicator* comm;
+    ProcessGrid grid;
+    size_t n_rows, n_cols, block;
+    size_t local_rows, local_cols;
+    std::vector<double> local;
+
+    // number of indices out of n owned by process p of nprocs
+    static size_t num_local(size_t n, size_t nb, int p, int nprocs) {
+        size_t n_blocks = n / nb;
+        size_t count = (n_blocks / nprocs) * nb;
+        size_t extra = n_blocks % nprocs;
+        if (static_cast<size_t>(p) < extra) {
+            count += nb;
+        }
+        else if (static_cast<size_t>(p) == extra) {
+            count += n % nb;
+        }
+        return count;
+    }
+
+    static size_t to_global(size_t l, size_t nb, int p, int nprocs) {
+        return ((l / nb) * nprocs + p) * nb + l % nb;
+    }
+
+    // copy the part of a full row-major matrix owned by grid position (pr, pc)
+    std::vector<double> pack_part(const Matrix& global, int pr, int pc) const {
+        size_t rows = num_local(n_rows, block, pr, grid.num_rows());
+        size_t cols = num_local(n_cols, block, pc, grid.num_cols());
+        std::vector<double> part(rows * cols);
+        for (size_t i = 0; i < rows; i++) {
+            const Vector& src = global[to_global(i, block, pr, grid.num_rows())];
+            for (size_t j = 0; j < cols; j++) {
+                part[i * cols + j] = src[to_global(j, block, pc, grid.num_cols())];
+            }
+        }
+        return part;
+    }
+
+    void unpack_part(Matrix& global, const std::vector<double>& part, int pr, int pc) const {
+        size_t rows = num_local(n_rows, block, pr, grid.num_rows());
+        size_t cols = num_local(n_cols, block, pc, grid.num_cols());
+        for (size_t i = 0; i < rows; i++) {
+            double* dst = global.row_data(to_global(i, block, pr, grid.num_rows()));
+            for (size_t j = 0; j < cols; j++) {
+                dst[to_global(j, block, pc, grid.num_cols())] = part[i * cols + j];
+            }
+        }
+    }
+
+    void check_layout(const DistributedMatrix& another_mat) const {
+        if (comm != another_mat.comm || block != another_mat.block
+            || grid.num_rows() != another_mat.grid.num_rows() || grid.num_cols() != another_mat.grid.num_cols()) {
+            throw std::invalid_argument("Distributed matrices must share communicator, grid and block size.");
+        }
+    }
+
+public:
+    DistributedMatrix(Communicator& communicator, const ProcessGrid& process_grid,
+                      const size_t nrows, const size_t ncols, const size_t block_size = 64)
+        : comm(&communicator), grid(process_grid), n_rows(nrows), n_cols(ncols), block(block_size) {
+        if (block == 0) {
+            throw std::invalid_argument("Block size must be > 0.");
+        }
+        // gather() builds a Matrix on root after the other ranks have sent
+        // their parts, so shapes Matrix rejects are rejected here up front
+        if (n_rows == 1 || n_cols == 1) {
+            throw std::invalid_argument("Matrix can't be 1 dimensional, both nrows and ncols must > 1.");
+        }
+        local_rows = num_local(n_rows, block, grid.row(), grid.num_rows());
+        local_cols = num_local(n_cols, block, grid.col(), grid.num_cols());
+        local.assign(local_rows * local_cols, 0.);
+    }
+
+    size_t num_rows() const { return n_rows; }
+    size_t num_cols() const { return n_cols; }
+    size_t num_local_rows() const { return local_rows; }
+    size_t num_local_cols() const { return local_cols; }
+
+    // global row / col index of a local one, to fill the local part in place
+    size_t global_row(size_t local_row) const {
+        return to_global(local_row, block, grid.row(), grid.num_rows());
+    }
+
+    size_t global_col(size_t local_col) const {
+        return to_global(local_col, block, grid.col(), grid.num_cols());
+    }
+
+    double& local_at(size_t row, size_t col) {
+        if (row >= local_rows || col >= local_cols) {
+            throw std::out_of_range("Index out of range.");
+        }
+        return local[row * local_cols + col];
+    }
+
+    const double& local_at(size_t row, size_t col) const {
+        if (row >= local_rows || col >= local_cols) {
+            throw std::out_of_range("Index out of range.");
+        }
+        return local[row * local_cols + col];
+    }
+
+    // distribute a matrix that only needs to be valid on root
+    void scatter(const Matrix& global, int root = 0) {
+        if (comm->rank() == root) {
+            if (global.num_rows() != n_rows || global.num_cols() != n_cols) {
+                throw std::invalid_argument("Matrix shape doesn't match the distributed matrix.");
+            }
+            for (int r = 0; r < comm->size(); r++) {
+                std::vector<double> part = pack_part(global, r / grid.num_cols(), r % grid.num_cols());
+                if (r == root) {
+                    local = part;
+                }
+                else {
+                    comm->send(r, part.data(), part.size() * sizeof(double));
+                }
+            }
+        }
+        else {
+            comm->recv(root, local.data(), local.size() * sizeof(double));
+        }
+    }
+
+    // collect the full matrix on root, other ranks get an empty Matrix
+    Matrix gather(int root = 0) const {
+        if (comm->rank() != root) {
+            comm->send(root, local.data(), local.size() * sizeof(double));
+            return Matrix();
+        }
+        Matrix global(n_rows, n_cols);
+        for (int r = 0; r < comm->size(); r++) {
+            int pr = r / grid.num_cols(), pc = r % grid.num_cols();
+            if (r == root) {
+                unpack_part(global, local, pr, pc);
+                continue;
+            }
+            std::vector<double> part(num_local(n_rows, block, pr, grid.num_rows())
+                                     * num_local(n_cols, block, pc, grid.num_cols()));
+            comm->recv(r, part.data(), part.size() * sizeof(double));
+            unpack_part(global, part, pr, pc);
+        }
+        return global;
+    }
+
+    // SUMMA: for every block column k of this matrix, its owner column
+    // broadcasts the panel along each grid row and the owner row of block
+    // row k of another_mat broadcasts along each grid column, then every
+    // rank adds the panel product to its local part of the result
+    DistributedMatrix dot(const DistributedMatrix& another_mat) const {
+        check_layout(another_mat);
+        if (n_cols != another_mat.n_rows) {
+            throw std::invalid_argument("mat_1's n_cols does not match mat_2's n_rows.");
+        }
+        DistributedMatrix rst(*comm, grid, n_rows, another_mat.n_cols, block);
+        std::vector<int> row_group = grid.row_group();
+        std::vector<int> col_group = grid.col_group();
+        std::vector<double> a_panel(local_rows * block), b_panel(block * rst.local_cols);
+        size_t n_blocks = (n_cols + block - 1) / block;
+        for (size_t kb = 0; kb < n_blocks; kb++) {
+            size_t width = std::min(block, n_cols - kb * block);
+            int owner_col = static_cast<int>(kb % grid.num_cols());
+            int owner_row = static_cast<int>(kb % grid.num_rows());
+
+            if (grid.col() == owner_col) {
+                size_t offset = (kb / grid.num_cols()) * block;
+                for (size_t i = 0; i < local_rows; i++) {
+                    const double* src = local.data() + i * local_cols + offset;
+                    std::copy(src, src + width, a_panel.data() + i * width);
+                }
+            }
+            comm->broadcast(a_panel.data(), local_rows * width, grid.rank_of(grid.row(), owner_col), row_group);
+
+            if (grid.row() == owner_row) {
+                size_t offset = (kb / grid.num_rows()) * block;
+                const double* src = another_mat.local.data() + offset * another_mat.local_cols;
+                std::copy(src, src + width * rst.local_cols, b_panel.data());
+            }
+            comm->broadcast(b_panel.data(), width * rst.local_cols, grid.rank_of(owner_row, grid.col()), col_group);
+
+            for (size_t i = 0; i < local_rows; i++) {
+                double* c_row = rst.local.data() + i * rst.local_cols;
+                for (size_t p = 0; p < width; p++) {
+                    double a_ip = a_panel[i * width + p];
+                    const double* b_row = b_panel.data() + p * rst.local_cols;
+                    for (size_t j = 0; j < rst.local_cols; j++) {
+                        c_row[j] += a_ip * b_row[j];
+                    }
+                }
+            }
+        }
+        return rst;
+    }
+
+    // matrix-vector product with vec replicated on every rank. Each rank
+    // multiplies its local part, the partial sums for its local rows are
+    // reduced across its grid row, then every grid row's segment is
+    // broadcast down the grid columns so all ranks get the full result.
+    Vector dot(const Vector& vec) const {
+        if (n_cols != vec.size()) {
+            throw std::invalid_argument("mat's n_cols does not match vec's size.");
+        }
+        std::vector<double> partial(local_rows, 0.);
+        std::vector<double> x_local(local_cols);
+        for (size_t j = 0; j < local_cols; j++) {
+            x_local[j] = vec[global_col(j)];
+        }
+        for (size_t i = 0; i < local_rows; i++) {
+            const double* row = local.data() + i * local_cols;
+            double sum = 0;
+            for (size_t j = 0; j < local_cols; j++) {
+                sum += row[j] * x_local[j];
+            }
+            partial[i] = sum;
+        }
+        comm->allreduce_sum(partial.data(), partial.size(), grid.row_group());
+
+        Vector rst(n_rows);
+        double* out = rst.data();
+        std::vector<int> col_group = grid.col_group();
+        std::vector<double> segment;
+        for (int pr = 0; pr < grid.num_rows(); pr++) {
+            size_t rows = num_local(n_rows, block, pr, grid.num_rows());
+            if (pr == grid.row()) {
+                segment = partial;
+            }
+            else {
+                segment.assign(rows, 0.);
+            }
+            comm->broadcast(segment.data(), rows, grid.rank_of(pr, grid.col()), col_group);
+            for (size_t i = 0; i < rows; i++) {
+                out[to_global(i, block, pr, grid.num_rows())] = segment[i];
+            }
+        }
+        return rst;
+    }
+};
+
+#endif
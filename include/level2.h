@@ -0,0 +1,375 @@
+#ifndef LEVEL2_H
+#define LEVEL2_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include "VecMat.h"
+#include "parallel.h"
+
+// Level-2 (matrix-vector) kernels. They are bound by reading the matrix,
+// so every kernel walks the rows of the row-major storage contiguously
+// and splits the work across threads once there is enough of it.
+
+namespace level2_detail {
+
+// matrix elements (multiply-adds) one thread has to get at least.
+// parallel_for starts and joins fresh threads on every call, which costs
+// tens of microseconds, about as long as streaming 2^16 doubles, so
+// smaller calls stay on the calling thread whatever their shape
+const size_t MIN_ELEMENTS = size_t(1) << 16;
+
+// columns one thread owns at least when gemv_t splits by column, so
+// neighbouring threads don't share cache lines of y
+const size_t MIN_COLS = 64;
+
+// min_chunk for parallel_for over items that each cost width elements
+inline size_t min_chunk(size_t width) {
+    return std::max<size_t>(1, MIN_ELEMENTS / std::max<size_t>(width, 1));
+}
+
+// number of threads worth starting for work elements in total
+inline size_t num_parts(size_t work) {
+    return std::max<size_t>(1, std::min(num_threads(), work / MIN_ELEMENTS));
+}
+
+inline void check_gemv(const Matrix& mat, const Vector& x, const Vector& y, bool transposed) {
+    size_t in_size = transposed ? mat.num_rows() : mat.num_cols();
+    size_t out_size = transposed ? mat.num_cols() : mat.num_rows();
+    if (x.size() != in_size) {
+        throw std::invalid_argument("x's size does not match the matrix.");
+    }
+    if (y.size() != out_size) {
+        throw std::invalid_argument("y's size does not match the matrix.");
+    }
+}
+
+// y = beta * y, all that is left to do when the matrix has no columns
+inline void scale(double beta, Vector& y) {
+    double* y_ptr = y.data();
+    for (size_t i = 0; i < y.size(); i++) {
+        y_ptr[i] = (beta == 0) ? 0 : beta * y_ptr[i];
+    }
+}
+
+// run fn(part, lo, hi) for the ranges [bounds[p], bounds[p + 1]), one
+// range per thread
+template <typename Func>
+void run_parts(const std::vector<size_t>& bounds, Func fn) {
+    parallel_for(0, bounds.size() - 1, [&](size_t lo, size_t hi) {
+        for (size_t p = lo; p < hi; p++) {
+            fn(p, bounds[p], bounds[p + 1]);
+        }
+    });
+}
+
+}
+
+// y = alpha * mat * x + beta * y
+inline void gemv(double alpha, const Matrix& mat, const Vector& x, double beta, Vector& y) {
+    level2_detail::check_gemv(mat, x, y, false);
+    size_t n_cols = mat.num_cols();
+    if (mat.num_rows() == 0) {
+        return;
+    }
+    if (n_cols == 0) {
+        level2_detail::scale(beta, y);
+        return;
+    }
+    const double* x_ptr = x.data();
+    double* y_ptr = y.data();
+    parallel_for(0, mat.num_rows(), [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++) {
+            const double* row = mat.row_data(i);
+            double sum = 0;
+            for (size_t j = 0; j < n_cols; j++) {
+                sum += row[j] * x_ptr[j];
+            }
+            y_ptr[i] = alpha * sum + (beta == 0 ? 0 : beta * y_ptr[i]);
+        }
+    }, level2_detail::min_chunk(n_cols));
+}
+
+namespace level2_detail {
+
+// gemv_t on n_parts ranges of rows, each summed into its own partial
+// result, the partials are added up in order at the end
+inline void gemv_t_by_rows(double alpha, const Matrix& mat, const Vector& x, double beta, Vector& y,
+                           size_t n_parts) {
+    size_t n_rows = mat.num_rows(), n_cols = mat.num_cols();
+    const double* x_ptr = x.data();
+    std::vector<size_t> bounds(n_parts + 1);
+    for (size_t p = 0; p <= n_parts; p++) {
+        bounds[p] = n_rows * p / n_parts;
+    }
+    std::vector<std::vector<double>> partials(n_parts, std::vector<double>(n_cols, 0.));
+    run_parts(bounds, [&](size_t part, size_t lo, size_t hi) {
+        double* sums = partials[part].data();
+        for (size_t i = lo; i < hi; i++) {
+            const double* row = mat.row_data(i);
+            double x_i = x_ptr[i];
+            for (size_t j = 0; j < n_cols; j++) {
+                sums[j] += x_i * row[j];
+            }
+        }
+    });
+    double* y_ptr = y.data();
+    for (size_t j = 0; j < n_cols; j++) {
+        double sum = 0;
+        for (const auto& partial : partials) {
+            sum += partial[j];
+        }
+        y_ptr[j] = alpha * sum + (beta == 0 ? 0 : beta * y_ptr[j]);
+    }
+}
+
+// symv on n_parts ranges of rows of equal triangle area, row i reads
+// n - i entries. Each range scatters into its own partial result.
+inline void symv_by_parts(double alpha, const Matrix& mat, const Vector& x, double beta, Vector& y,
+                          size_t n_parts) {
+    size_t n = mat.num_rows();
+    const double* x_ptr = x.data();
+    std::vector<size_t> bounds(n_parts + 1, n);
+    bounds[0] = 0;
+    double total = 0.5 * static_cast<double>(n) * static_cast<double>(n + 1);
+    double done = 0;
+    size_t part = 1;
+    for (size_t i = 0; i < n && part < n_parts; i++) {
+        if (done >= total * part / n_parts) {
+            bounds[part++] = i;
+        }
+        done += static_cast<double>(n - i);
+    }
+
+    std::vector<std::vector<double>> partials(n_parts);
+    run_parts(bounds, [&](size_t p, size_t lo, size_t hi) {
+        std::vector<double>& partial = partials[p];
+        partial.assign(n, 0.);
+        for (size_t i = lo; i < hi; i++) {
+            const double* row = mat.row_data(i);
+            double sum = row[i] * x_ptr[i];
+            double x_i = x_ptr[i];
+            for (size_t j = i + 1; j < n; j++) {
+                sum += row[j] * x_ptr[j];
+                partial[j] += row[j] * x_i;
+            }
+            partial[i] += sum;
+        }
+    });
+    double* y_ptr = y.data();
+    for (size_t i = 0; i < n; i++) {
+        double sum = 0;
+        for (size_t p = 0; p < n_parts && bounds[p] <= i; p++) {
+            sum += partials[p][i];
+        }
+        y_ptr[i] = alpha * sum + (beta == 0 ? 0 : beta * y_ptr[i]);
+    }
+}
+
+}
+
+// y = alpha * mat^T * x + beta * y, computed as a sum of scaled rows so
+// the matrix is streamed row by row instead of strided by column. Each
+// thread owns a range of columns, so no reduction is needed. A matrix
+// too narrow to give every thread MIN_COLS columns is split by rows
+// instead, see gemv_t_by_rows.
+inline void gemv_t(double alpha, const Matrix& mat, const Vector& x, double beta, Vector& y) {
+    level2_detail::check_gemv(mat, x, y, true);
+    size_t n_rows = mat.num_rows(), n_cols = mat.num_cols();
+    if (n_cols == 0) {
+        return;
+    }
+    if (n_rows == 0) {
+        level2_detail::scale(beta, y);
+        return;
+    }
+    size_t row_parts = level2_detail::num_parts(n_rows * n_cols);
+    size_t col_chunk = std::max(level2_detail::MIN_COLS, level2_detail::min_chunk(n_rows));
+    size_t col_parts = std::min(row_parts, n_cols / col_chunk);
+    if (col_parts < row_parts) {
+        level2_detail::gemv_t_by_rows(alpha, mat, x, beta, y, row_parts);
+        return;
+    }
+
+    const double* x_ptr = x.data();
+    double* y_ptr = y.data();
+    parallel_for(0, n_cols, [&](size_t lo, size_t hi) {
+        for (size_t j = lo; j < hi; j++) {
+            y_ptr[j] = (beta == 0) ? 0 : beta * y_ptr[j];
+        }
+        for (size_t i = 0; i < n_rows; i++) {
+            const double* row = mat.row_data(i);
+            double scale = alpha * x_ptr[i];
+            for (size_t j = lo; j < hi; j++) {
+                y_ptr[j] += scale * row[j];
+            }
+        }
+    }, col_chunk);
+}
+
+// mat = mat + alpha * x * y^T
+inline void ger(double alpha, const Vector& x, const Vector& y, Matrix& mat) {
+    if (x.size() != mat.num_rows() || y.size() != mat.num_cols()) {
+        throw std::invalid_argument("Vector sizes do not match the matrix.");
+    }
+    size_t n_cols = mat.num_cols();
+    if (mat.num_rows() == 0 || n_cols == 0) {
+        return;
+    }
+    const double* x_ptr = x.data();
+    const double* y_ptr = y.data();
+    // non-const row access may detach shared storage, so take the row
+    // pointers before the threads start
+    std::vector<double*> rows(mat.num_rows());
+    for (size_t i = 0; i < rows.size(); i++) {
+        rows[i] = mat.row_data(i);
+    }
+    parallel_for(0, mat.num_rows(), [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++) {
+            double* row = rows[i];
+            double scale = alpha * x_ptr[i];
+            for (size_t j = 0; j < n_cols; j++) {
+                row[j] += scale * y_ptr[j];
+            }
+        }
+    }, level2_detail::min_chunk(n_cols));
+}
+
+// y = alpha * mat * x + beta * y for symmetric mat, only the upper
+// triangle is read. Row i gives y_i its dot product with x[i:] and
+// scatters mat[i][j] * x_i into y_j for j > i, see symv_by_parts.
+inline void symv(double alpha, const Matrix& mat, const Vector& x, double beta, Vector& y) {
+    if (mat.num_rows() != mat.num_cols()) {
+        throw std::invalid_argument("symv needs a square matrix.");
+    }
+    level2_detail::check_gemv(mat, x, y, false);
+    size_t n = mat.num_rows();
+    if (n == 0) {
+        return;
+    }
+    level2_detail::symv_by_parts(alpha, mat, x, beta, y, level2_detail::num_parts(n * (n + 1) / 2));
+}
+
+// solve mat * x = b in place (x holds b on entry) for triangular mat.
+// Rows are solved in blocks: the dot products of a block's rows with the
+// already solved part of x are split across threads, then the small
+// triangle on the diagonal is solved serially.
+inline void trsv(const Matrix& mat, Vector& x, bool lower = true, bool unit_diag = false) {
+    if (mat.num_rows() != mat.num_cols()) {
+        throw std::invalid_argument("trsv needs a square matrix.");
+    }
+    if (x.size() != mat.num_rows()) {
+        throw std::invalid_argument("x's size does not match the matrix.");
+    }
+    const size_t block = 256;
+    size_t n = mat.num_rows();
+    if (n == 0) {
+        return;
+    }
+    double* x_ptr = x.data();
+    for (size_t done = 0; done < n; done += block) {
+        size_t count = std::min(block, n - done);
+        // rows of this block and the already solved columns
+        size_t first = lower ? done : n - done - count;
+        size_t solved_lo = lower ? 0 : n - done;
+        size_t solved_hi = lower ? done : n;
+        parallel_for(first, first + count, [&](size_t lo, size_t hi) {
+            for (size_t i = lo; i < hi; i++) {
+                const double* row = mat.row_data(i);
+                double sum = 0;
+                for (size_t j = solved_lo; j < solved_hi; j++) {
+                    sum += row[j] * x_ptr[j];
+                }
+                x_ptr[i] -= sum;
+            }
+        }, level2_detail::min_chunk(solved_hi - solved_lo));
+        for (size_t step = 0; step < count; step++) {
+            size_t i = lower ? first + step : first + count - 1 - step;
+            const double* row = mat.row_data(i);
+            double sum = 0;
+            size_t j_lo = lower ? first : i + 1;
+            size_t j_hi = lower ? i : first + count;
+            for (size_t j = j_lo; j < j_hi; j++) {
+                sum += row[j] * x_ptr[j];
+            }
+            x_ptr[i] -= sum;
+            if (!unit_diag) {
+                if (row[i] == 0) {
+                    throw std::invalid_argument("Matrix is singular.");
+                }
+                x_ptr[i] /= row[i];
+            }
+        }
+    }
+}
+
+// ys[r] = alpha * mat * xs[r] + beta * ys[r] for several right-hand sides
+// at once. The xs are interleaved so one pass over each row feeds every
+// right-hand side, the matrix is read once instead of once per vector.
+inline void gemv_multi(double alpha, const Matrix& mat, const std::vector<Vector>& xs,
+                       double beta, std::vector<Vector>& ys) {
+    if (xs.size() != ys.size()) {
+        throw std::invalid_argument("Number of x and y vectors doesn't match.");
+    }
+    for (size_t r = 0; r < xs.size(); r++) {
+        level2_detail::check_gemv(mat, xs[r], ys[r], false);
+    }
+    size_t n_rhs = xs.size(), n_cols = mat.num_cols();
+    if (n_rhs == 0 || mat.num_rows() == 0) {
+        return;
+    }
+    if (n_cols == 0) {
+        for (auto& y : ys) {
+            level2_detail::scale(beta, y);
+        }
+        return;
+    }
+    std::vector<double> packed(n_cols * n_rhs);
+    for (size_t r = 0; r < n_rhs; r++) {
+        const double* x_ptr = xs[r].data();
+        for (size_t j = 0; j < n_cols; j++) {
+            packed[j * n_rhs + r] = x_ptr[j];
+        }
+    }
+    std::vector<double*> y_ptrs(n_rhs);
+    for (size_t r = 0; r < n_rhs; r++) {
+        y_ptrs[r] = ys[r].data();
+    }
+    parallel_for(0, mat.num_rows(), [&](size_t lo, size_t hi) {
+        std::vector<double> sums(n_rhs);
+        for (size_t i = lo; i < hi; i++) {
+            const double* row = mat.row_data(i);
+            std::fill(sums.begin(), sums.end(), 0.);
+            for (size_t j = 0; j < n_cols; j++) {
+                double a_ij = row[j];
+                const double* x_j = &packed[j * n_rhs];
+                for (size_t r = 0; r < n_rhs; r++) {
+                    sums[r] += a_ij * x_j[r];
+                }
+            }
+            for (size_t r = 0; r < n_rhs; r++) {
+                y_ptrs[r][i] = alpha * sums[r] + (beta == 0 ? 0 : beta * y_ptrs[r][i]);
+            }
+        }
+    }, level2_detail::min_chunk(n_cols * n_rhs));
+}
+
+inline Vector Vector::dot(const Matrix& mat) const {
+    if (size() != mat.num_rows()) {
+        throw std::invalid_argument("vec's size does not math mat's n_rows.");
+    }
+    Vector rst(mat.num_cols());
+    gemv_t(1., mat, *this, 0., rst);
+    return rst;
+}
+
+inline Vector Matrix::dot(const Vector& vec) const {
+    if (n_cols != vec.size()) {
+        throw std::invalid_argument("mat's n_cols does not match vec's size.");
+    }
+    Vector rst(n_rows);
+    gemv(1., *this, vec, 0., rst);
+    return rst;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// number of worker threads the kernels may use, at least 1
+inline size_t num_threads() {
+    unsigned int hw = std::thread::hardware_concurrency();
+    return hw == 0 ? 1 : static_cast<size_t>(hw);
+}
+
+// split [begin, end) into contiguous ranges and call fn(lo, hi) on each,
+// ranges smaller than min_chunk are not split further
+template <typename Func>
+void parallel_for(size_t begin, size_t end, Func fn, size_t min_chunk = 1) {
+    if (end <= begin) {
+        return;
+    }
+    size_t total = end - begin;
+    size_t n_workers = std::min(num_threads(), (total + min_chunk - 1) / std::max<size_t>(min_chunk, 1));
+    if (n_workers <= 1) {
+        fn(begin, end);
+        return;
+    }
+    size_t chunk = (total + n_workers - 1) / n_workers;
+    std::vector<std::thread> workers;
+    for (size_t lo = begin + chunk; lo < end; lo += chunk) {
+        size_t hi = std::min(lo + chunk, end);
+        workers.emplace_back([=, &fn]() { fn(lo, hi); });
+    }
+    fn(begin, std::min(begin + chunk, end));
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+#endif
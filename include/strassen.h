@@ -0,0 +1,230 @@
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+#include <algorithm>
+#include <future>
+#include <vector>
+#include "VecMat.h"
+#include "blocked_gemm.h"
+#include "parallel.h"
+
+// below this size (on the smallest dimension) the recursion hands off
+// to the conventional blocked kernel. Tuned by timing strassen_dot on
+// random n x n matrices for cutoffs 32 to 256, best of 3, on one core:
+// 64 was fastest or tied at n = 512, 1024 and 2048 (431 ms at n = 1024
+// against 725 ms for 128 and 777 ms for 256), and leaves of 64 fit one
+// block of blocked_gemm. Below n = 300 every cutoff stays within 10% of
+// Matrix::dot. A smaller cutoff means more levels and so a looser error
+// bound, which grows as 18^depth. Re-run the sweep when the kernel or
+// target machine changes.
+const size_t STRASSEN_DEFAULT_CUTOFF = 64;
+
+namespace strassen_detail {
+
+// all helpers work on row-major blocks given as (pointer, leading dimension)
+
+// c = a + b
+inline void add(const double* a, size_t lda, const double* b, size_t ldb,
+                double* c, size_t ldc, size_t rows, size_t cols) {
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < cols; j++) {
+            c[i * ldc + j] = a[i * lda + j] + b[i * ldb + j];
+        }
+    }
+}
+
+// c = a - b
+inline void sub(const double* a, size_t lda, const double* b, size_t ldb,
+                double* c, size_t ldc, size_t rows, size_t cols) {
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < cols; j++) {
+            c[i * ldc + j] = a[i * lda + j] - b[i * ldb + j];
+        }
+    }
+}
+
+// c = a * b with the classical blocked kernel, a is m x k, b is k x n
+inline void gemm(const double* a, size_t lda, const double* b, size_t ldb,
+                 double* c, size_t ldc, size_t m, size_t k, size_t n) {
+    for (size_t i = 0; i < m; i++) {
+        std::fill(c + i * ldc, c + i * ldc + n, 0.);
+    }
+    blocked_gemm(m, k, n,
+                 [=](size_t i) { return a + i * lda; },
+                 [=](size_t p) { return b + p * ldb; },
+                 [=](size_t i) { return c + i * ldc; });
+}
+
+// c = a * b by Strassen-Winograd, m, k, n must be divisible by 2^depth.
+// The sequential levels follow the two-temporary schedule of Boyer,
+// Dumas, Pernet and Zhou, so each level only needs an m/2 x max(k,n)/2
+// and a k/2 x n/2 scratch block and C's quadrants hold the products.
+// The top par_levels levels instead give every one of the seven
+// products its own operands and output so they can run concurrently.
+inline void winograd(const double* a, size_t lda, const double* b, size_t ldb,
+                     double* c, size_t ldc, size_t m, size_t k, size_t n,
+                     size_t depth, size_t par_levels) {
+    if (depth == 0) {
+        gemm(a, lda, b, ldb, c, ldc, m, k, n);
+        return;
+    }
+    size_t m2 = m / 2, k2 = k / 2, n2 = n / 2;
+    const double* a11 = a;
+    const double* a12 = a + k2;
+    const double* a21 = a + m2 * lda;
+    const double* a22 = a21 + k2;
+    const double* b11 = b;
+    const double* b12 = b + n2;
+    const double* b21 = b + k2 * ldb;
+    const double* b22 = b21 + n2;
+    double* c11 = c;
+    double* c12 = c + n2;
+    double* c21 = c + m2 * ldc;
+    double* c22 = c21 + n2;
+
+    if (par_levels == 0) {
+        size_t ldx = std::max(k2, n2);
+        std::vector<double> x_buf(m2 * ldx), y_buf(k2 * n2);
+        double* x = x_buf.data();
+        double* y = y_buf.data();
+        auto recurse = [&](const double* lhs, size_t ldl, const double* rhs, size_t ldr, double* out) {
+            winograd(lhs, ldl, rhs, ldr, out, ldc, m2, k2, n2, depth - 1, 0);
+        };
+        sub(a11, lda, a21, lda, x, ldx, m2, k2);        // S3
+        sub(b22, ldb, b12, ldb, y, n2, k2, n2);         // T3
+        recurse(x, ldx, y, n2, c21);                    // P7
+        add(a21, lda, a22, lda, x, ldx, m2, k2);        // S1
+        sub(b12, ldb, b11, ldb, y, n2, k2, n2);         // T1
+        recurse(x, ldx, y, n2, c22);                    // P5
+        sub(x, ldx, a11, lda, x, ldx, m2, k2);          // S2
+        sub(b22, ldb, y, n2, y, n2, k2, n2);            // T2
+        recurse(x, ldx, y, n2, c12);                    // P6
+        sub(a12, lda, x, ldx, x, ldx, m2, k2);          // S4
+        sub(y, n2, b21, ldb, y, n2, k2, n2);            // T4
+        recurse(x, ldx, b22, ldb, c11);                 // P3
+        winograd(a11, lda, b11, ldb, x, ldx, m2, k2, n2, depth - 1, 0);    // P1
+        add(x, ldx, c12, ldc, c12, ldc, m2, n2);        // U2 = P1 + P6
+        add(c12, ldc, c21, ldc, c21, ldc, m2, n2);      // U3 = U2 + P7
+        add(c12, ldc, c22, ldc, c12, ldc, m2, n2);      // U4 = U2 + P5
+        add(c21, ldc, c22, ldc, c22, ldc, m2, n2);      // U7 = U3 + P5
+        add(c12, ldc, c11, ldc, c12, ldc, m2, n2);      // U5 = U4 + P3
+        recurse(a22, lda, y, n2, c11);                  // P4
+        sub(c21, ldc, c11, ldc, c21, ldc, m2, n2);      // U6 = U3 - P4
+        recurse(a12, lda, b21, ldb, c11);               // P2
+        add(x, ldx, c11, ldc, c11, ldc, m2, n2);        // U1 = P1 + P2
+        return;
+    }
+
+    // P2..P5 are written straight into C's quadrants, only P1, P6 and P7
+    // need their own buffers
+    size_t a_size = m2 * k2, b_size = k2 * n2, c_size = m2 * n2;
+    std::vector<double> s(4 * a_size), t(4 * b_size), p(3 * c_size);
+    double* s1 = s.data();
+    double* s2 = s1 + a_size;
+    double* s3 = s2 + a_size;
+    double* s4 = s3 + a_size;
+    double* t1 = t.data();
+    double* t2 = t1 + b_size;
+    double* t3 = t2 + b_size;
+    double* t4 = t3 + b_size;
+    double* p1 = p.data();
+    double* p6 = p1 + c_size;
+    double* p7 = p6 + c_size;
+    add(a21, lda, a22, lda, s1, k2, m2, k2);
+    sub(s1, k2, a11, lda, s2, k2, m2, k2);
+    sub(a11, lda, a21, lda, s3, k2, m2, k2);
+    sub(a12, lda, s2, k2, s4, k2, m2, k2);
+    sub(b12, ldb, b11, ldb, t1, n2, k2, n2);
+    sub(b22, ldb, t1, n2, t2, n2, k2, n2);
+    sub(b22, ldb, b12, ldb, t3, n2, k2, n2);
+    sub(t2, n2, b21, ldb, t4, n2, k2, n2);
+
+    struct Product { const double* lhs; size_t ldl; const double* rhs; size_t ldr; double* out; size_t ldo; };
+    const Product products[7] = {
+        {a11, lda, b11, ldb, p1, n2},    // P1
+        {a12, lda, b21, ldb, c11, ldc},  // P2
+        {s4, k2, b22, ldb, c12, ldc},    // P3
+        {a22, lda, t4, n2, c21, ldc},    // P4
+        {s1, k2, t1, n2, c22, ldc},      // P5
+        {s2, k2, t2, n2, p6, n2},        // P6
+        {s3, k2, t3, n2, p7, n2},        // P7
+    };
+    auto run = [&](size_t i) {
+        winograd(products[i].lhs, products[i].ldl, products[i].rhs, products[i].ldr,
+                 products[i].out, products[i].ldo, m2, k2, n2, depth - 1, par_levels - 1);
+    };
+    std::vector<std::future<void>> tasks;
+    for (size_t i = 1; i < 7; i++) {
+        tasks.push_back(std::async(std::launch::async, run, i));
+    }
+    run(0);
+    for (auto& task : tasks) {
+        task.get();
+    }
+
+    add(p1, n2, c11, ldc, c11, ldc, m2, n2);        // U1 = P1 + P2
+    add(p1, n2, p6, n2, p6, n2, m2, n2);            // U2 = P1 + P6
+    add(p6, n2, p7, n2, p7, n2, m2, n2);            // U3 = U2 + P7
+    add(p6, n2, c22, ldc, p6, n2, m2, n2);          // U4 = U2 + P5
+    add(p6, n2, c12, ldc, c12, ldc, m2, n2);        // U5 = U4 + P3
+    sub(p7, n2, c21, ldc, c21, ldc, m2, n2);        // U6 = U3 - P4
+    add(p7, n2, c22, ldc, c22, ldc, m2, n2);        // U7 = U3 + P5
+}
+
+}
+
+// matrix product by Strassen-Winograd recursion for large operands.
+// Dimensions are zero padded up to a multiple of 2^depth, where depth is
+// the number of halvings that brings the smallest dimension down to the
+// cutoff, so odd and non-square shapes are handled.
+//
+// Besides the three padded copies (3 n^2 doubles for n x n operands),
+// scratch is needed per recursion level. A sequential level holds two
+// quarter blocks and its subtree adds at most a third more, 2/3 n^2 in
+// all. A parallel level holds 4 quarter blocks of A, 4 of B and 3 of C
+// for each of its nodes, and its 7 children run at the same time, so for
+// n x n operands the peak is about 3.9 n^2 with one parallel level and
+// 9.6 n^2 with two. A second level is only used when there are at least
+// two threads per product of the first.
+inline Matrix strassen_dot(const Matrix& mat_1, const Matrix& mat_2, size_t cutoff = STRASSEN_DEFAULT_CUTOFF) {
+    if (mat_1.num_cols() != mat_2.num_rows()) {
+        throw std::invalid_argument("mat_1's n_cols does not match mat_2's n_rows.");
+    }
+    size_t m = mat_1.num_rows(), k = mat_1.num_cols(), n = mat_2.num_cols();
+    cutoff = std::max<size_t>(cutoff, 2);
+    size_t min_dim = std::min({m, k, n});
+    if (min_dim <= cutoff) {
+        return mat_1.dot(mat_2);
+    }
+
+    size_t depth = 0;
+    while ((min_dim >> depth) > cutoff) {
+        depth++;
+    }
+    size_t par_levels = 0;
+    for (size_t tasks = 1; tasks * 2 <= num_threads() && par_levels < depth; tasks *= 7) {
+        par_levels++;
+    }
+
+    size_t step = size_t(1) << depth;
+    size_t pm = (m + step - 1) / step * step;
+    size_t pk = (k + step - 1) / step * step;
+    size_t pn = (n + step - 1) / step * step;
+    std::vector<double> a(pm * pk, 0.), b(pk * pn, 0.), c(pm * pn);
+    for (size_t i = 0; i < m; i++) {
+        std::copy(mat_1[i].begin(), mat_1[i].end(), a.begin() + i * pk);
+    }
+    for (size_t i = 0; i < k; i++) {
+        std::copy(mat_2[i].begin(), mat_2[i].end(), b.begin() + i * pn);
+    }
+
+    strassen_detail::winograd(a.data(), pk, b.data(), pn, c.data(), pn, pm, pk, pn, depth, par_levels);
+
+    Matrix rst(m, n);
+    for (size_t i = 0; i < m; i++) {
+        std::copy(c.begin() + i * pn, c.begin() + i * pn + n, rst.row_data(i));
+    }
+    return rst;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef TEXT_IO_H
+#define TEXT_IO_H
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "VecMat.h"
+#include "parallel.h"
+
+namespace text_io_detail {
+
+// files are cut into line-aligned chunks of about this many bytes, the
+// chunks are then shared out between the threads
+const size_t CHUNK_BYTES = size_t(1) << 16;
+
+// read-only mapping of a whole file, unmapped on destruction
+class MappedFile {
+private:
+    const char* data_ptr = nullptr;
+    size_t length = 0;
+
+public:
+    MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Can't open " + path + ".");
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Can't stat " + path + ".");
+        }
+        length = static_cast<size_t>(st.st_size);
+        if (length > 0) {
+            void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Can't mmap " + path + ".");
+            }
+            madvise(addr, length, MADV_SEQUENTIAL);
+            data_ptr = static_cast<const char*>(addr);
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_ptr != nullptr) {
+            munmap(const_cast<char*>(data_ptr), length);
+        }
+    }
+
+    const char* data() const { return data_ptr; }
+    size_t size() const { return length; }
+};
+
+// numbers parsed from one line-aligned slice of the file
+struct ParsedChunk {
+    std::vector<double> values;
+    std::vector<size_t> row_lengths;
+    std::string error;
+};
+
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool is_separator(char c, char delim) {
+    return c == delim || is_blank(c);
+}
+
+inline std::string snippet(const char* first, const char* last) {
+    const char* line_end = std::find(first, last, '\n');
+    return std::string(first, std::min<size_t>(line_end - first, 32));
+}
+
+// runs of blanks merge, but a delimiter must sit between two values, so
+// an empty field is an error instead of shifting the columns after it
+inline void parse_chunk(const char* first, const char* last, char delim, ParsedChunk& chunk) {
+    const char* ptr = first;
+    while (ptr < last) {
+        const char* line = ptr;
+        size_t count = 0;
+        bool need_value = false;
+        while (ptr < last && *ptr != '\n') {
+            if (is_blank(*ptr)) {
+                ptr++;
+                continue;
+            }
+            if (*ptr == delim) {
+                if (count == 0 || need_value) {
+                    chunk.error = "Empty field in \"" + snippet(line, last) + "\".";
+                    return;
+                }
+                need_value = true;
+                ptr++;
+                continue;
+            }
+            // from_chars takes no '+', skip it only in front of a digit or
+            // '.' so tokens like "+-3" are still rejected
+            if (*ptr == '+' && ptr + 1 < last
+                && ((ptr[1] >= '0' && ptr[1] <= '9') || ptr[1] == '.')) {
+                ptr++;
+            }
+            double value;
+            auto [end, ec] = std::from_chars(ptr, last, value);
+            if (ec != std::errc() || (end < last && *end != '\n' && !is_separator(*end, delim))) {
+                chunk.error = "Can't parse number near \"" + snippet(ptr, last) + "\".";
+                return;
+            }
+            chunk.values.push_back(value);
+            count++;
+            need_value = false;
+            ptr = end;
+        }
+        if (need_value) {
+            chunk.error = "Empty field in \"" + snippet(line, last) + "\".";
+            return;
+        }
+        if (count > 0) {
+            chunk.row_lengths.push_back(count);
+        }
+        ptr++;      // skip '\n'
+    }
+}
+
+}
+
+// load a matrix from a delimited text file, one row per line. Values are
+// separated by blanks and tabs, by the delimiter, or by both, so CSV and
+// whitespace separated files load. Blank lines are skipped, empty fields
+// (two delimiters in a row, or one at either end of a line) and rows of
+// different lengths are errors. The file is mmap'ed, cut into line-aligned
+// chunks and the chunks are parsed in parallel with std::from_chars.
+inline Matrix load_text(const std::string& path, char delim = ',') {
+    text_io_detail::MappedFile file(path);
+    const char* data = file.data();
+    size_t length = file.size();
+
+    size_t n_chunks = std::max<size_t>(1, length / text_io_detail::CHUNK_BYTES);
+    std::vector<size_t> bounds(n_chunks + 1, length);
+    bounds[0] = 0;
+    for (size_t i = 1; i < n_chunks; i++) {
+        size_t pos = std::max(bounds[i - 1], length / n_chunks * i);
+        const char* newline = std::find(data + pos, data + length, '\n');
+        bounds[i] = std::min(length, static_cast<size_t>(newline - data) + 1);
+    }
+
+    std::vector<text_io_detail::ParsedChunk> chunks(n_chunks);
+    parallel_for(0, n_chunks, [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; i++) {
+            text_io_detail::parse_chunk(data + bounds[i], data + bounds[i + 1], delim, chunks[i]);
+        }
+    });
+
+    size_t n_rows = 0, n_cols = 0;
+    for (const auto& chunk : chunks) {
+        if (!chunk.error.empty()) {
+            throw std::invalid_argument(path + ": " + chunk.error);
+        }
+        for (size_t len : chunk.row_lengths) {
+            if (n_cols == 0) {
+                n_cols = len;
+            }
+            else if (len != n_cols) {
+                throw std::invalid_argument(path + ": rows have different numbers of columns.");
+            }
+        }
+        n_rows += chunk.row_lengths.size();
+    }
+
+    Matrix rst(n_rows, n_cols);
+    size_t row = 0;
+    for (const auto& chunk : chunks) {
+        for (size_t i = 0; i < chunk.row_lengths.size(); i++, row++) {
+            auto src = chunk.values.begin() + i * n_cols;
+            std::copy(src, src + n_cols, rst.row_data(row));
+        }
+    }
+    return rst;
+}
+
+// write a matrix as delimited text. By default each value is written in
+// the shortest form that reads back to the same double; a non-negative
+// precision writes that many significant digits instead. Blocks of rows
+// are formatted in parallel with std::to_chars into large buffers that
+// are then written in order.
+inline void write_text(const Matrix& mat, const std::string& path, int precision = -1, char delim = ',') {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (out == nullptr) {
+        throw std::runtime_error("Can't open " + path + " for writing.");
+    }
+    const size_t max_chars = 32 + static_cast<size_t>(std::max(precision, 0));     // one value plus separator
+    size_t n_rows = mat.num_rows(), n_cols = mat.num_cols();
+    size_t row_bytes = std::max<size_t>(1, n_cols * max_chars);
+    size_t rows_per_batch = std::max<size_t>(1, (size_t(64) << 20) / row_bytes);
+    size_t n_parts = num_threads();
+    std::vector<std::string> parts(n_parts);
+
+    for (size_t batch = 0; batch < n_rows; batch += rows_per_batch) {
+        size_t batch_end = std::min(batch + rows_per_batch, n_rows);
+        size_t rows_per_part = (batch_end - batch + n_parts - 1) / n_parts;
+        parallel_for(0, n_parts, [&](size_t lo, size_t hi) {
+            for (size_t p = lo; p < hi; p++) {
+                size_t first = std::min(batch + p * rows_per_part, batch_end);
+                size_t last = std::min(first + rows_per_part, batch_end);
+                std::string& buf = parts[p];
+                buf.resize((last - first) * row_bytes);
+                char* ptr = buf.data();
+                char* buf_end = buf.data() + buf.size();
+                for (size_t i = first; i < last; i++) {
+                    const double* row = mat.row_data(i);
+                    for (size_t j = 0; j < n_cols; j++) {
+                        ptr = (precision < 0)
+                            ? std::to_chars(ptr, buf_end, row[j]).ptr
+                            : std::to_chars(ptr, buf_end, row[j], std::chars_format::general, precision).ptr;
+                        *ptr++ = (j + 1 == n_cols) ? '\n' : delim;
+                    }
+                }
+                buf.resize(ptr - buf.data());
+            }
+        });
+        for (const auto& buf : parts) {
+            if (fwrite(buf.data(), 1, buf.size(), out) != buf.size()) {
+                fclose(out);
+                throw std::runtime_error("Failed writing " + path + ".");
+            }
+        }
+    }
+    if (fclose(out) != 0) {
+        throw std::runtime_error("Failed writing " + path + ".");
+    }
+}
+
+#endif
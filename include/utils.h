@@ -10,7 +10,7 @@
 Matrix diagnal(const size_t size, const double value) {
     Matrix rst(size, size);
     for (size_t i = 0; i < size; i++){
-        rst[i][i] = value;
+        rst.row_data(i)[i] = value;
     }
     return rst;
 }
@@ -21,8 +21,9 @@ Matrix Randomize_Matrix_Entries(const Matrix& mat, double start=0., double end=1
     std::uniform_real_distribution<double> unif(start, end);
     Matrix rst(mat.num_rows(), mat.num_cols());
     for (size_t i = 0; i < mat.num_rows(); i++) {
+        double* row = rst.row_data(i);
         for (size_t j = 0; j < mat.num_cols(); j++) {
-            rst[i][j] = unif(gen);
+            row[j] = unif(gen);
         }
     }
     return rst;
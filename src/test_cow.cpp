@@ -0,0 +1,200 @@
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <utility>
+#include "VecMat.h"
+#include "utils.h"
+
+// checks the copy-on-write storage of Vector and Matrix: copies share
+// until a write, reads never copy, a write copies only what it touches,
+// and the CowStats counters say exactly what was copied
+
+using namespace std;
+
+bool report(bool ok, const string& what) {
+    printf("%s %s\n", ok ? "PASS" : "FAIL", what.c_str());
+    return ok;
+}
+
+bool no_copies() {
+    return CowStats::vector_detaches == 0 && CowStats::matrix_detaches == 0 && CowStats::bytes_copied == 0;
+}
+
+// the way a handler taking its argument by value reads it
+double sum_by_value(Matrix mat) {
+    double rst = 0;
+    for (size_t i = 0; i < mat.num_rows(); i++) {
+        for (size_t j = 0; j < mat.num_cols(); j++) {
+            rst += mat[i][j];
+        }
+    }
+    return rst;
+}
+
+bool check_reads_share() {
+    Matrix mat = Randomize_Matrix_Entries(Matrix(500, 500));
+    Vector vec(100, 2.);
+    CowStats::reset();
+    double sum = sum_by_value(mat);
+    Vector copy = vec;
+    double vec_sum = 0;
+    for (size_t i = 0; i < copy.size(); i++) {
+        vec_sum += copy[i];
+    }
+    for (double value : copy) {
+        vec_sum += value;
+    }
+    Matrix mat_copy = mat;
+    for (auto row : mat_copy) {
+        vec_sum += row[0];
+    }
+    Matrix another_copy = mat_copy;
+    bool ok = no_copies() && sum > 0 && vec_sum > 0 && copy.is_shared() && another_copy.is_shared();
+    return report(ok, "reads of copies share storage");
+}
+
+bool check_write_detaches_one_row() {
+    Matrix mat = Randomize_Matrix_Entries(Matrix(40, 30));
+    const Matrix original = mat;
+    CowStats::reset();
+    Matrix copy = mat;
+    copy[3][4] = -1.;
+    bool ok = CowStats::matrix_detaches == 1 && CowStats::vector_detaches == 1
+              && CowStats::bytes_copied == 40 * sizeof(Vector) + 30 * sizeof(double)
+              && mat[3][4] == original[3][4] && copy[3][4] == -1.;
+    // the untouched rows still point at the same data
+    for (size_t i = 0; i < 40; i++) {
+        ok = ok && (as_const(copy).row_data(i) == as_const(mat).row_data(i)) == (i != 3);
+    }
+    // a second write to the same row copies nothing more
+    copy[3][5] += 1.;
+    ok = ok && CowStats::matrix_detaches == 1 && CowStats::vector_detaches == 1;
+    return report(ok, "a write copies the row list and only its row");
+}
+
+bool check_proxy_across_copy() {
+    bool ok = true;
+    Vector vec(4, 0.);
+    auto elem = vec[0];
+    Vector vec_copy = vec;
+    elem = 1.;
+    ok = ok && vec_copy[0] == 0. && vec[0] == 1.;
+
+    Matrix mat(3, 3, 0.);
+    auto row = mat[1];
+    Matrix copy_1 = mat;
+    row[2] = 5.;
+    auto elem_2 = mat[1][1];
+    Matrix copy_2 = mat;
+    elem_2 += 7.;
+    auto row_0 = mat[0];
+    Matrix copy_3 = mat;
+    row_0 = Vector(3, 9.);
+    ok = ok && copy_1[1][2] == 0. && copy_2[1][1] == 0. && copy_3[0][0] == 0.
+         && mat[1][2] == 5. && mat[1][1] == 7. && mat[0][0] == 9.;
+
+    // assigning a row from the same matrix
+    mat[2] = mat[1];
+    ok = ok && mat[2][2] == 5. && copy_3[2][2] == 0.;
+    return report(ok, "a proxy kept across a copy can't change the copy");
+}
+
+bool check_data_pointer() {
+    Vector vec(8, 1.);
+    CowStats::reset();
+    double* ptr = vec.data();
+    ptr[0] = 2.;
+    bool ok = no_copies();
+    Vector copy = vec;
+    vec.data()[1] = 3.;
+    ok = ok && CowStats::vector_detaches == 1 && copy[1] == 1. && vec[1] == 3. && copy[0] == 2.;
+    Matrix mat(4, 4, 1.);
+    Matrix mat_copy = mat;
+    mat.row_data(2)[2] = 0.;
+    ok = ok && mat_copy[2][2] == 1. && mat[2][2] == 0.;
+    return report(ok, "data() and row_data() detach before handing out a pointer");
+}
+
+bool check_moved_from() {
+    Vector vec(5, 1.);
+    Vector moved = move(vec);
+    bool ok = vec.size() == 0 && moved.size() == 5 && vec.begin() == vec.end();
+    Vector copy = vec;
+    vec = Vector(2, 3.);
+    ok = ok && copy.size() == 0 && vec[1] == 3.;
+
+    Matrix mat(3, 3, 1.);
+    Matrix moved_mat(move(mat));
+    ok = ok && mat.num_rows() == 0 && mat.num_cols() == 0 && mat.begin() == mat.end();
+    Matrix mat_copy = mat;
+    mat = moved_mat;
+    ok = ok && mat_copy.num_rows() == 0 && mat[2][2] == 1. && moved_mat.is_shared();
+    moved_mat = Matrix(2, 2, 4.);
+    ok = ok && mat[2][2] == 1. && moved_mat[1][1] == 4.;
+    return report(ok, "moved-from objects stay valid");
+}
+
+bool check_const_ops() {
+    const Matrix mat_1 = Randomize_Matrix_Entries(Matrix(50, 40));
+    const Matrix mat_2 = Randomize_Matrix_Entries(Matrix(40, 30));
+    Matrix shared_1 = mat_1, shared_2 = mat_2;
+    const Vector vec(40, 1.);
+    CowStats::reset();
+    Matrix product = mat_1.dot(mat_2);
+    Matrix transposed = mat_1.transpose();
+    Vector mat_vec = mat_1.dot(vec);
+    bool ok = no_copies() && shared_1.is_shared() && shared_2.is_shared();
+    // element-wise operators copy the left operand, one detach per row
+    Matrix sum = mat_1 + shared_1;
+    ok = ok && CowStats::matrix_detaches == 1 && CowStats::vector_detaches == 50;
+    return report(ok, "const products and transpose never copy");
+}
+
+// NaN never compares equal, shared buffer or not
+bool check_equality() {
+    Vector nan_vec(3, NAN);
+    Vector copy = nan_vec;
+    Vector vec(3, 1.), vec_copy = vec, other(3, 1.);
+    bool ok = !(nan_vec == nan_vec) && !(nan_vec == copy) && vec == vec_copy && vec == other;
+    return report(ok, "equality compares values");
+}
+
+// threads reading copies of one matrix while another writes its own copy
+bool check_concurrent_copies() {
+    const Matrix mat = Randomize_Matrix_Entries(Matrix(200, 200));
+    Matrix expected = mat.transpose();
+    bool ok_1 = true, ok_2 = true;
+    thread reader([&]() {
+        Matrix copy = mat;
+        for (int k = 0; k < 5; k++) {
+            Matrix transposed = copy.transpose();
+            ok_1 = ok_1 && transposed[7][3] == expected[7][3];
+        }
+    });
+    thread writer([&]() {
+        Matrix copy = mat;
+        for (int k = 0; k < 5; k++) {
+            copy[k][k] = -1.;
+            ok_2 = ok_2 && copy[k][k] == -1.;
+        }
+    });
+    reader.join();
+    writer.join();
+    bool ok = ok_1 && ok_2 && mat[0][0] != -1.;
+    return report(ok, "copies are read and written from two threads");
+}
+
+int main() {
+    int failures = 0;
+    failures += !check_reads_share();
+    failures += !check_write_detaches_one_row();
+    failures += !check_proxy_across_copy();
+    failures += !check_data_pointer();
+    failures += !check_moved_from();
+    failures += !check_const_ops();
+    failures += !check_equality();
+    failures += !check_concurrent_copies();
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#include "VecMat.h"
+#include "utils.h"
+#include "distributed.h"
+
+// runs the distributed kernels on local processes and compares them with
+// the single process results, then checks that failing ranks are reported
+
+using namespace std;
+
+const double TOLERANCE = 1e-12;
+
+bool check_products(int nprocs, int grid_rows, size_t m, size_t k, size_t n, size_t block) {
+    Matrix mat_1 = Randomize_Matrix_Entries(Matrix(m, k), -1., 1.);
+    Matrix mat_2 = Randomize_Matrix_Entries(Matrix(k, n), -1., 1.);
+    Vector vec(k);
+    for (size_t i = 0; i < k; i++) {
+        vec[i] = sin(0.1 * i);
+    }
+    Matrix expected = mat_1.dot(mat_2);
+    Vector expected_vec = mat_1.dot(vec);
+
+    int failed = launch_local_ranks(nprocs, [&](Communicator& comm) {
+        ProcessGrid grid(comm, grid_rows, nprocs / grid_rows);
+        DistributedMatrix dist_1(comm, grid, m, k, block), dist_2(comm, grid, k, n, block);
+        dist_1.scatter(mat_1);
+        dist_2.scatter(mat_2);
+
+        Vector rst_vec = dist_1.dot(vec);
+        for (size_t i = 0; i < m; i++) {
+            if (fabs(rst_vec[i] - expected_vec[i]) > TOLERANCE) {
+                throw runtime_error("matrix-vector product mismatch");
+            }
+        }
+
+        Matrix rst = dist_1.dot(dist_2).gather();
+        if (comm.rank() == 0) {
+            for (size_t i = 0; i < m; i++) {
+                for (size_t j = 0; j < n; j++) {
+                    if (fabs(rst[i][j] - expected[i][j]) > TOLERANCE) {
+                        throw runtime_error("SUMMA product mismatch");
+                    }
+                }
+            }
+        }
+    });
+    bool ok = failed == 0;
+    printf("%s %d rank(s) on %dx%d grid, %zux%zux%zu block %zu\n",
+           ok ? "PASS" : "FAIL", nprocs, grid_rows, nprocs / grid_rows, m, k, n, block);
+    return ok;
+}
+
+// rank 2 dies while rank 0 is still sending to it, the caller has to get
+// the failure count back instead of being killed by SIGPIPE
+bool check_dead_peer() {
+    int failed = launch_local_ranks(3, [](Communicator& comm) {
+        if (comm.rank() == 2) {
+            throw runtime_error("expected failure");
+        }
+        if (comm.rank() == 0) {
+            vector<double> payload(1 << 22, 1.);
+            comm.send(2, payload.data(), payload.size() * sizeof(double));
+        }
+    });
+    bool ok = failed == 2;
+    printf("%s dead peer reported as %d failed rank(s)\n", ok ? "PASS" : "FAIL", failed);
+    return ok;
+}
+
+bool check_unknown_exception() {
+    int failed = launch_local_ranks(2, [](Communicator& comm) {
+        if (comm.rank() == 1) {
+            throw 42;
+        }
+    });
+    bool ok = failed == 1;
+    printf("%s non-std exception reported as %d failed rank(s)\n", ok ? "PASS" : "FAIL", failed);
+    return ok;
+}
+
+// every rank has to reject a shape Matrix can't hold before any message
+// is sent, otherwise gather() would throw on root after the others sent
+bool check_one_dimensional() {
+    int failed = launch_local_ranks(2, [](Communicator& comm) {
+        ProcessGrid grid(comm, 1, 2);
+        for (size_t shape : {0, 1}) {
+            try {
+                DistributedMatrix dist(comm, grid, shape ? 5 : 1, shape ? 1 : 5, 2);
+            }
+            catch (const invalid_argument&) {
+                continue;
+            }
+            throw runtime_error("1 dimensional shape accepted");
+        }
+    });
+    bool ok = failed == 0;
+    printf("%s 1 dimensional shapes rejected\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// a backend can replace the tree collectives with its own, here one that
+// counts calls and defers to the default
+class CountingCommunicator : public Communicator {
+private:
+    Communicator& inner;
+
+public:
+    int broadcasts = 0, allreduces = 0;
+
+    explicit CountingCommunicator(Communicator& comm) : inner(comm) {}
+
+    int rank() const override { return inner.rank(); }
+    int size() const override { return inner.size(); }
+    void send(int dest, const void* data, size_t bytes) override { inner.send(dest, data, bytes); }
+    void recv(int src, void* data, size_t bytes) override { inner.recv(src, data, bytes); }
+
+    using Communicator::allreduce_sum;
+
+    void broadcast(double* data, size_t count, int root, const vector<int>& group) override {
+        broadcasts++;
+        Communicator::broadcast(data, count, root, group);
+    }
+
+    void allreduce_sum(double* data, size_t count, const vector<int>& group) override {
+        allreduces++;
+        Communicator::allreduce_sum(data, count, group);
+    }
+};
+
+bool check_overridden_collectives() {
+    const size_t m = 20, k = 30;
+    Matrix mat = Randomize_Matrix_Entries(Matrix(m, k), -1., 1.);
+    Vector vec(k, 1.);
+    Vector expected = mat.dot(vec);
+    int failed = launch_local_ranks(4, [&](Communicator& comm) {
+        CountingCommunicator counting(comm);
+        ProcessGrid grid(counting, 2, 2);
+        DistributedMatrix dist(counting, grid, m, k, 4);
+        dist.scatter(mat);
+        Vector rst = dist.dot(vec);
+        for (size_t i = 0; i < m; i++) {
+            if (fabs(rst[i] - expected[i]) > TOLERANCE) {
+                throw runtime_error("matrix-vector product mismatch");
+            }
+        }
+        if (counting.broadcasts == 0 || counting.allreduces == 0) {
+            throw runtime_error("overridden collectives were not called");
+        }
+    });
+    bool ok = failed == 0;
+    printf("%s overridden collectives are used\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+int main() {
+    int failures = 0;
+    failures += !check_products(1, 1, 37, 29, 41, 8);
+    failures += !check_products(2, 1, 64, 64, 64, 16);
+    failures += !check_products(3, 1, 50, 70, 30, 7);
+    failures += !check_products(4, 2, 137, 91, 203, 16);
+    failures += !check_products(6, 2, 100, 45, 77, 9);
+    failures += !check_products(6, 3, 33, 120, 65, 5);
+    failures += !check_products(7, 1, 40, 90, 60, 4);
+    failures += !check_products(8, 2, 70, 66, 90, 6);
+    failures += !check_dead_peer();
+    failures += !check_unknown_exception();
+    failures += !check_one_dimensional();
+    failures += !check_overridden_collectives();
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,250 @@
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "VecMat.h"
+#include "utils.h"
+#include "level2.h"
+
+// checks the Level-2 kernels against plain loops over the rows. The
+// row-split gemv_t and the symv partitioning are also run with a fixed
+// number of parts, so they are covered whatever the number of cores.
+
+using namespace std;
+
+const double TOLERANCE = 1e-10;
+
+Vector make_vector(size_t size, double phase) {
+    Vector rst(size);
+    double* ptr = rst.data();
+    for (size_t i = 0; i < size; i++) {
+        ptr[i] = sin(phase + 0.7 * i);
+    }
+    return rst;
+}
+
+double max_abs_diff(const Vector& vec_1, const Vector& vec_2) {
+    if (vec_1.size() != vec_2.size()) {
+        return INFINITY;
+    }
+    double rst = 0;
+    for (size_t i = 0; i < vec_1.size(); i++) {
+        rst = max(rst, fabs(vec_1.data()[i] - vec_2.data()[i]));
+    }
+    return rst;
+}
+
+// alpha * op(mat) * x + beta * y the obvious way
+Vector naive_gemv(double alpha, const Matrix& mat, const Vector& x, double beta, const Vector& y, bool transposed) {
+    size_t out_size = transposed ? mat.num_cols() : mat.num_rows();
+    Vector rst(out_size);
+    for (size_t i = 0; i < out_size; i++) {
+        double sum = 0;
+        for (size_t j = 0; j < x.size(); j++) {
+            sum += (transposed ? mat.row_data(j)[i] : mat.row_data(i)[j]) * x.data()[j];
+        }
+        rst.data()[i] = alpha * sum + (beta == 0 ? 0 : beta * y.data()[i]);
+    }
+    return rst;
+}
+
+bool report(bool ok, const string& what, double err) {
+    printf("%s %s: error %.3e\n", ok ? "PASS" : "FAIL", what.c_str(), err);
+    return ok;
+}
+
+string shape(size_t m, size_t n) {
+    return to_string(m) + "x" + to_string(n);
+}
+
+bool check_gemv(size_t m, size_t n) {
+    Matrix mat = Randomize_Matrix_Entries(Matrix(m, n), -1., 1.);
+    Vector x = make_vector(n, 0.1), y = make_vector(m, 0.2);
+    Vector expected = naive_gemv(1.5, mat, x, -0.5, y, false);
+    Vector rst = y;
+    gemv(1.5, mat, x, -0.5, rst);
+    double err = max_abs_diff(rst, expected);
+    // beta = 0 must overwrite y, even NaN
+    Vector nan_y(m, NAN);
+    gemv(1.5, mat, x, 0., nan_y);
+    double err_0 = max_abs_diff(nan_y, naive_gemv(1.5, mat, x, 0., y, false));
+    // matrix-vector dot is gemv with alpha = 1, beta = 0
+    double err_dot = max_abs_diff(mat.dot(x), naive_gemv(1., mat, x, 0., y, false));
+    err = max({err, err_0, err_dot});
+    return report(err <= TOLERANCE, "gemv " + shape(m, n), err);
+}
+
+bool check_gemv_t(size_t m, size_t n) {
+    Matrix mat = Randomize_Matrix_Entries(Matrix(m, n), -1., 1.);
+    Vector x = make_vector(m, 0.3), y = make_vector(n, 0.4);
+    Vector expected = naive_gemv(2., mat, x, 3., y, true);
+    Vector rst = y;
+    gemv_t(2., mat, x, 3., rst);
+    double err = max_abs_diff(rst, expected);
+    for (size_t n_parts = 1; n_parts <= 7; n_parts++) {
+        Vector by_rows = y;
+        level2_detail::gemv_t_by_rows(2., mat, x, 3., by_rows, n_parts);
+        err = max(err, max_abs_diff(by_rows, expected));
+    }
+    err = max(err, max_abs_diff(x.dot(mat), naive_gemv(1., mat, x, 0., y, true)));
+    return report(err <= TOLERANCE, "gemv_t " + shape(m, n) + ", 1 to 7 row parts", err);
+}
+
+bool check_ger(size_t m, size_t n) {
+    Matrix mat = Randomize_Matrix_Entries(Matrix(m, n), -1., 1.);
+    const Matrix original = mat;
+    Vector x = make_vector(m, 0.5), y = make_vector(n, 0.6);
+    ger(0.25, x, y, mat);
+    double err = 0;
+    for (size_t i = 0; i < m; i++) {
+        for (size_t j = 0; j < n; j++) {
+            double expected = original.row_data(i)[j] + 0.25 * x.data()[i] * y.data()[j];
+            err = max(err, fabs(mat.row_data(i)[j] - expected));
+        }
+    }
+    return report(err <= TOLERANCE, "ger " + shape(m, n), err);
+}
+
+// the lower triangle holds garbage, symv must only read the upper one
+bool check_symv(size_t n) {
+    Matrix upper = Randomize_Matrix_Entries(Matrix(n, n), -1., 1.);
+    Matrix full = upper;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < i; j++) {
+            full.row_data(i)[j] = upper.row_data(j)[i];
+            upper.row_data(i)[j] = 1e6;
+        }
+    }
+    Vector x = make_vector(n, 0.7), y = make_vector(n, 0.8);
+    Vector expected = naive_gemv(-1.5, full, x, 0.5, y, false);
+    Vector rst = y;
+    symv(-1.5, upper, x, 0.5, rst);
+    double err = max_abs_diff(rst, expected);
+    for (size_t n_parts = 1; n_parts <= 8; n_parts++) {
+        Vector by_parts = y;
+        level2_detail::symv_by_parts(-1.5, upper, x, 0.5, by_parts, n_parts);
+        err = max(err, max_abs_diff(by_parts, expected));
+    }
+    return report(err <= TOLERANCE, "symv " + to_string(n) + ", 1 to 8 parts", err);
+}
+
+// solves T x = T v for v, with the other triangle and, for a unit
+// diagonal, the diagonal itself set to values trsv must not read
+bool check_trsv(size_t n, bool lower, bool unit_diag) {
+    Matrix tri = Randomize_Matrix_Entries(Matrix(n, n), -1., 1.);
+    Matrix clean(n, n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            bool inside = lower ? j < i : j > i;
+            if (i == j) {
+                tri.row_data(i)[i] = unit_diag ? 1e6 : n + tri.row_data(i)[i];
+                clean.row_data(i)[i] = unit_diag ? 1. : tri.row_data(i)[i];
+            }
+            else if (inside) {
+                clean.row_data(i)[j] = tri.row_data(i)[j] / n;
+                tri.row_data(i)[j] = clean.row_data(i)[j];
+            }
+            else {
+                tri.row_data(i)[j] = 1e6;
+            }
+        }
+    }
+    Vector v = make_vector(n, 0.9);
+    Vector x = clean.dot(v);
+    trsv(tri, x, lower, unit_diag);
+    double err = max_abs_diff(x, v);
+    return report(err <= TOLERANCE, string("trsv ") + to_string(n) + (lower ? " lower" : " upper")
+                  + (unit_diag ? " unit diagonal" : ""), err);
+}
+
+bool check_trsv_singular() {
+    Matrix tri = Randomize_Matrix_Entries(Matrix(300, 300), 1., 2.);
+    tri.row_data(280)[280] = 0.;
+    Vector x = make_vector(300, 0.);
+    bool ok = false;
+    try {
+        trsv(tri, x, true);
+    }
+    catch (const invalid_argument&) {
+        ok = true;
+    }
+    return report(ok, "trsv rejects a singular matrix", 0.);
+}
+
+bool check_gemv_multi(size_t m, size_t n, size_t n_rhs) {
+    Matrix mat = Randomize_Matrix_Entries(Matrix(m, n), -1., 1.);
+    vector<Vector> xs, ys;
+    for (size_t r = 0; r < n_rhs; r++) {
+        xs.push_back(make_vector(n, 1. + r));
+        ys.push_back(make_vector(m, 2. + r));
+    }
+    vector<Vector> expected;
+    for (size_t r = 0; r < n_rhs; r++) {
+        expected.push_back(naive_gemv(0.5, mat, xs[r], 2., ys[r], false));
+    }
+    gemv_multi(0.5, mat, xs, 2., ys);
+    double err = 0;
+    for (size_t r = 0; r < n_rhs; r++) {
+        err = max(err, max_abs_diff(ys[r], expected[r]));
+    }
+    return report(err <= TOLERANCE, "gemv_multi " + shape(m, n) + " with " + to_string(n_rhs) + " right-hand sides", err);
+}
+
+// empty inputs are valid and leave nothing to compute
+bool check_empty() {
+    bool ok = Matrix().dot(Vector(size_t(0))).size() == 0
+              && Vector(size_t(0)).dot(Matrix()).size() == 0;
+    Matrix empty;
+    Vector none(size_t(0));
+    gemv(1., empty, none, 0., none);
+    gemv_t(1., empty, none, 0., none);
+    ger(1., none, none, empty);
+    symv(1., empty, none, 0., none);
+    trsv(empty, none);
+    vector<Vector> xs, ys;
+    gemv_multi(1., empty, xs, 0., ys);
+    return report(ok, "empty inputs", 0.);
+}
+
+bool check_mismatch() {
+    Matrix mat(3, 4);
+    Vector x(3), y(3);
+    int thrown = 0;
+    try { gemv(1., mat, x, 0., y); } catch (const invalid_argument&) { thrown++; }
+    try { gemv_t(1., mat, x, 0., y); } catch (const invalid_argument&) { thrown++; }
+    try { symv(1., mat, Vector(4), 0., y); } catch (const invalid_argument&) { thrown++; }
+    try { trsv(mat, x); } catch (const invalid_argument&) { thrown++; }
+    try { mat.dot(x); } catch (const invalid_argument&) { thrown++; }
+    return report(thrown == 5, "size mismatches are rejected", 0.);
+}
+
+int main() {
+    int failures = 0;
+    failures += !check_gemv(37, 29);
+    failures += !check_gemv(300, 257);
+    failures += !check_gemv(2000, 8);
+    failures += !check_gemv_t(37, 29);
+    failures += !check_gemv_t(300, 257);
+    failures += !check_gemv_t(5000, 40);     // tall and narrow, split by rows
+    failures += !check_gemv_t(5, 3000);
+    failures += !check_ger(37, 29);
+    failures += !check_ger(500, 300);
+    for (size_t n : {2, 3, 65, 300}) {
+        failures += !check_symv(n);
+    }
+    for (size_t n : {5, 600}) {                 // one block and several
+        for (int lower = 0; lower < 2; lower++) {
+            for (int unit_diag = 0; unit_diag < 2; unit_diag++) {
+                failures += !check_trsv(n, lower, unit_diag);
+            }
+        }
+    }
+    failures += !check_trsv_singular();
+    failures += !check_gemv_multi(300, 257, 1);
+    failures += !check_gemv_multi(301, 97, 5);
+    failures += !check_empty();
+    failures += !check_mismatch();
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
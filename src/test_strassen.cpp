@@ -0,0 +1,114 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include "VecMat.h"
+#include "utils.h"
+#include "strassen.h"
+
+// checks strassen_dot against the classical Matrix::dot, the difference
+// must stay within the sum of both methods' forward error bounds
+
+using namespace std;
+
+const double UNIT_ROUNDOFF = DBL_EPSILON / 2;
+
+double max_abs(const Matrix& mat) {
+    double rst = 0;
+    for (const auto& row : mat) {
+        for (double value : row) {
+            rst = max(rst, fabs(value));
+        }
+    }
+    return rst;
+}
+
+double max_abs_diff(const Matrix& mat_1, const Matrix& mat_2) {
+    double rst = 0;
+    for (size_t i = 0; i < mat_1.num_rows(); i++) {
+        for (size_t j = 0; j < mat_1.num_cols(); j++) {
+            rst = max(rst, fabs(mat_1[i][j] - mat_2[i][j]));
+        }
+    }
+    return rst;
+}
+
+// Higham's bound for Winograd's variant in the max norm,
+// [(n0^2 + 6 n0) 18^depth - 6 n] u |A| |B|, applied to the largest
+// padded dimension n with leaf size n0
+double winograd_bound(size_t n, size_t depth, double a_norm, double b_norm) {
+    double n0 = static_cast<double>(n >> depth);
+    return ((n0 * n0 + 6 * n0) * pow(18., static_cast<double>(depth)) - 6. * n) * UNIT_ROUNDOFF * a_norm * b_norm;
+}
+
+// the classical product's error is at most k u |A| |B| per entry, and
+// each entry of |A| |B| is at most k |A| |B| in the max norm
+double classical_bound(size_t k, double a_norm, double b_norm) {
+    return static_cast<double>(k) * k * UNIT_ROUNDOFF * a_norm * b_norm;
+}
+
+size_t recursion_depth(size_t min_dim, size_t cutoff) {
+    size_t depth = 0;
+    while ((min_dim >> depth) > cutoff) {
+        depth++;
+    }
+    return depth;
+}
+
+bool check_shape(size_t m, size_t k, size_t n, size_t cutoff) {
+    Matrix mat_1 = Randomize_Matrix_Entries(Matrix(m, k), -1., 1.);
+    Matrix mat_2 = Randomize_Matrix_Entries(Matrix(k, n), -1., 1.);
+    Matrix classical = mat_1.dot(mat_2);
+    Matrix fast = strassen_dot(mat_1, mat_2, cutoff);
+
+    size_t depth = recursion_depth(min({m, k, n}), cutoff);
+    size_t step = size_t(1) << depth;
+    size_t padded = (max({m, k, n}) + step - 1) / step * step;
+    double a_norm = max_abs(mat_1), b_norm = max_abs(mat_2);
+    double bound = winograd_bound(padded, depth, a_norm, b_norm) + classical_bound(k, a_norm, b_norm);
+    double err = max_abs_diff(classical, fast);
+    bool ok = fast.num_rows() == m && fast.num_cols() == n && err <= bound;
+    printf("%s %zux%zux%zu cutoff %zu depth %zu: error %.3e bound %.3e\n",
+           ok ? "PASS" : "FAIL", m, k, n, cutoff, depth, err, bound);
+    return ok;
+}
+
+// runs the recursion with parallel levels directly, so the concurrent
+// schedule is covered whatever the number of cores
+bool check_parallel_levels(size_t par_levels) {
+    const size_t n = 96, depth = 3;
+    vector<double> a(n * n), b(n * n), classical(n * n), fast(n * n);
+    for (size_t i = 0; i < n * n; i++) {
+        a[i] = sin(0.37 * i);
+        b[i] = cos(0.11 * i);
+    }
+    strassen_detail::gemm(a.data(), n, b.data(), n, classical.data(), n, n, n, n);
+    strassen_detail::winograd(a.data(), n, b.data(), n, fast.data(), n, n, n, n, depth, par_levels);
+    double err = 0;
+    for (size_t i = 0; i < n * n; i++) {
+        err = max(err, fabs(classical[i] - fast[i]));
+    }
+    double bound = winograd_bound(n, depth, 1., 1.) + classical_bound(n, 1., 1.);
+    bool ok = err <= bound;
+    printf("%s %zu parallel level(s): error %.3e bound %.3e\n", ok ? "PASS" : "FAIL", par_levels, err, bound);
+    return ok;
+}
+
+int main() {
+    size_t shapes[][4] = {
+        {5, 7, 3, 16},          // below the cutoff, classical path
+        {64, 64, 64, 16},       // powers of two, no padding
+        {67, 33, 65, 8},        // odd dimensions
+        {130, 260, 70, 16},     // non-square
+        {100, 37, 129, 4},      // deep recursion with padding
+        {300, 257, 301, 32},
+    };
+    int failures = 0;
+    for (auto& shape : shapes) {
+        failures += !check_shape(shape[0], shape[1], shape[2], shape[3]);
+    }
+    for (size_t par_levels = 1; par_levels <= 2; par_levels++) {
+        failures += !check_parallel_levels(par_levels);
+    }
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include "VecMat.h"
+#include "utils.h"
+#include "text_io.h"
+
+// writes matrices with write_text and reads them back with load_text,
+// then checks that malformed files are rejected instead of loading wrong
+
+using namespace std;
+
+const string TMP_PATH = "test_text_io.tmp";
+
+void write_file(const string& content) {
+    FILE* out = fopen(TMP_PATH.c_str(), "wb");
+    if (out == nullptr) {
+        throw runtime_error("Can't open " + TMP_PATH + " for writing.");
+    }
+    fwrite(content.data(), 1, content.size(), out);
+    fclose(out);
+}
+
+size_t file_size() {
+    FILE* in = fopen(TMP_PATH.c_str(), "rb");
+    fseek(in, 0, SEEK_END);
+    size_t size = static_cast<size_t>(ftell(in));
+    fclose(in);
+    return size;
+}
+
+bool same_bits(const Matrix& mat_1, const Matrix& mat_2) {
+    if (mat_1.num_rows() != mat_2.num_rows() || mat_1.num_cols() != mat_2.num_cols()) {
+        return false;
+    }
+    for (size_t i = 0; i < mat_1.num_rows(); i++) {
+        for (size_t j = 0; j < mat_1.num_cols(); j++) {
+            if (mat_1.row_data(i)[j] != mat_2.row_data(i)[j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool report(bool ok, const string& what) {
+    printf("%s %s\n", ok ? "PASS" : "FAIL", what.c_str());
+    return ok;
+}
+
+// the default writes the shortest form that reads back exactly, including
+// subnormals and the extremes of the range
+bool check_round_trip() {
+    Matrix mat = Randomize_Matrix_Entries(Matrix(50, 7), -1e3, 1e3);
+    const double specials[] = {0.1, -0., DBL_MIN, DBL_MAX, -DBL_MAX, 5e-324, M_PI};
+    for (size_t j = 0; j < 7; j++) {
+        mat.row_data(0)[j] = specials[j];
+        mat.row_data(1)[j] = 1. / (j + 3);
+    }
+    write_text(mat, TMP_PATH);
+    return report(same_bits(mat, load_text(TMP_PATH)), "exact round trip at the default precision");
+}
+
+bool check_fixed_precision() {
+    Matrix mat(2, 2, 1. / 3);
+    mat.row_data(1)[1] = 123456.;
+    write_text(mat, TMP_PATH, 3, ' ');
+    Matrix rst = load_text(TMP_PATH, ' ');
+    bool ok = file_size() == string("0.333 0.333\n0.333 1.23e+05\n").size()
+              && rst.row_data(0)[0] == 0.333 && rst.row_data(1)[1] == 123000.;
+    return report(ok, "fixed precision of 3 digits");
+}
+
+// content must load as exactly the given 2 x 3 values
+bool check_loads(const string& content, const double (&expected)[6], const string& what) {
+    write_file(content);
+    bool ok = false;
+    try {
+        Matrix rst = load_text(TMP_PATH);
+        ok = rst.num_rows() == 2 && rst.num_cols() == 3;
+        for (size_t i = 0; ok && i < 6; i++) {
+            ok = rst.row_data(i / 3)[i % 3] == expected[i];
+        }
+    }
+    catch (const exception& e) {
+        printf("  %s\n", e.what());
+    }
+    return report(ok, what);
+}
+
+bool check_rejects(const string& content, const string& what) {
+    write_file(content);
+    bool ok = false;
+    try {
+        load_text(TMP_PATH);
+    }
+    catch (const invalid_argument& e) {
+        printf("  %s\n", e.what());
+        ok = true;
+    }
+    return report(ok, what);
+}
+
+// a file of several chunks, so rows are split between parsers, must load
+// exactly, and an error in its last chunk must still be reported
+bool check_large_file() {
+    Matrix mat = Randomize_Matrix_Entries(Matrix(3000, 12), -1., 1.);
+    write_text(mat, TMP_PATH);
+    size_t size = file_size();
+    bool ok = size > 4 * text_io_detail::CHUNK_BYTES && same_bits(mat, load_text(TMP_PATH));
+    report(ok, "round trip of a " + to_string(size / 1024) + " KiB file");
+
+    FILE* out = fopen(TMP_PATH.c_str(), "ab");
+    fputs("1,,2,3,4,5,6,7,8,9,10,11\n", out);
+    fclose(out);
+    bool rejected = false;
+    try {
+        load_text(TMP_PATH);
+    }
+    catch (const invalid_argument&) {
+        rejected = true;
+    }
+    return report(rejected, "empty field in the last chunk of a large file") && ok;
+}
+
+int main() {
+    const double one_to_six[6] = {1, 2, 3, 4, 5, 6};
+    int failures = 0;
+    failures += !check_round_trip();
+    failures += !check_fixed_precision();
+    failures += !check_loads("1,2,3\r\n4,5,6\r\n", one_to_six, "CRLF line endings");
+    failures += !check_loads("\n1 2 3\n  \n\n4\t5   6\n\n", one_to_six, "blank lines and whitespace");
+    failures += !check_loads("1 , 2,3\n4 ,5 , 6", one_to_six, "blanks around delimiters, no final newline");
+    failures += !check_loads("+1,+2.,+.3e1\n4,5,6\n", one_to_six, "leading '+'");
+    failures += !check_rejects("1,2,3\n4,5\n", "ragged rows");
+    failures += !check_rejects("1,,3\n4,,6\n", "empty field");
+    failures += !check_rejects(",1,2\n3,4,5\n", "leading delimiter");
+    failures += !check_rejects("1,2,\n3,4,5\n", "trailing delimiter");
+    failures += !check_rejects("+-3,1\n2,3\n", "'+' before a sign");
+    failures += !check_rejects("1,+\n2,3\n", "lone '+'");
+    failures += !check_rejects("1e400,1\n2,3\n", "out of range value");
+    failures += !check_rejects("1,2x\n3,4\n", "trailing garbage");
+    failures += !check_large_file();
+    remove(TMP_PATH.c_str());
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}